@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 
 /* A block device. */
@@ -28,6 +29,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void count (unsigned long long *, size_t);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -122,7 +124,7 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
   block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  count (&block->read_cnt, 1);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -136,7 +138,57 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
   block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  count (&block->write_cnt, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Uses a single device command if the driver can.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+  count (&block->read_cnt, cnt);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Uses a single device command if the driver can.  Returns after
+   the block device has acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  size_t i;
+
+  ASSERT (cnt > 0);
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         buffer + i * BLOCK_SECTOR_SIZE);
+  count (&block->write_cnt, cnt);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +212,18 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Returns the number of sectors written to BLOCK since it was
+   registered.  A multi-sector write counts each of its sectors, so
+   this is independent of how writes are batched into commands. */
+unsigned long long
+block_write_cnt (struct block *block)
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned long long cnt = block->write_cnt;
+  intr_set_level (old_level);
+  return cnt;
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -221,3 +285,12 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+/* Adds N to the sector counter *CNT.  Transfers to one device may run
+   in several threads at once, and a 64-bit add is not atomic. */
+static void
+count (unsigned long long *cnt, size_t n)
+{
+  enum intr_level old_level = intr_disable ();
+  *cnt += n;
+  intr_set_level (old_level);
+}
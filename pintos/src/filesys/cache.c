@@ -4,201 +4,1570 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "devices/block.h"
+#include <stdio.h>
 #include <string.h>
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
 #include <debug.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <bitmap.h>
+#include <round.h>
+#include <stdlib.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 
-#define NUM_ENTRIES 64
 #define INVALID_SECTOR -1
 
-struct data {
-	unsigned char contents[BLOCK_SECTOR_SIZE];
-};
+/* Sectors that fit in one page of memory, which is also the largest
+   cache unit. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The cache only borrows pages from the user pool while more than this
+   many would still be left free for user processes. */
+#define USER_RESERVE_PAGES 64
 
+/* Each entry caches a unit of BUFCACHE_UNIT consecutive sectors, starting
+   at a multiple of BUFCACHE_UNIT, and moves it to and from the disk with a
+   single command.  Each sector keeps its own data_lock, so that a thread
+   may pin two sectors of the same unit at once. */
 struct metadata {
-	block_sector_t sector;
-	struct data *entry;
-	struct list_elem lru_elem;
+	block_sector_t sector;          /* First sector of the unit. */
+	uint8_t *contents;              /* UNIT_BYTES of sector data. */
+	struct list_elem lru_elem;      /* Element in the replacement policy's lists. */
+	bool hot;                       /* 2Q: in the Am queue rather than A1in. */
+	struct hash_elem hash_elem;     /* Element in sector_index while sector is valid. */
 	struct condition until_ready;
+	struct rw_lock *data_locks;     /* Guard each sector's contents while pinned. */
+	int pin_cnt;                    /* Threads using the entry; pinned entries are never evicted. */
 	bool ready;
 	bool dirty;
+	bool prefetched;                /* Loaded by read-ahead and not used since. */
+	struct owner *owner;            /* Thread charged for the entry, if any. */
+	struct list_elem owner_elem;    /* Element in the owner's entries. */
+	bool zero[SECTORS_PER_PAGE];    /* Sector I is known to be all zeros. */
+	bool partial;                   /* Only VALID_START...VALID_END hold data. */
+	uint16_t valid_start;           /* Written range of a partial entry,
+									   guarded by fill_lock once ready. */
+	uint16_t valid_end;             /* The rest is read in before a read
+									   outside the range, a write that does
+									   not touch it, a pin or write-back. */
+};
+
+/* Counters reported by bufcache_get_stats(), guarded by cache_lock. */
+static struct cache_stats stats;
+
+/* Device bytes read to fill partial entries, guarded by fill_lock. */
+static uint64_t fill_bytes;
+
+/* Counters as of the last reset_cache(), for get_hit_rate() and
+   get_device_writes(). */
+static struct cache_stats stats_at_reset;
+static unsigned long long device_writes_at_reset;
+
+/* Write-behind tuning, settable from the kernel command line.
+   The flusher writes dirty entries back every BUFCACHE_FLUSH_TICKS
+   timer ticks, or sooner once more than BUFCACHE_HIGH_WATER percent of
+   the entries are dirty.  A BUFCACHE_FLUSH_TICKS of 0 or less turns the
+   periodic write-back off. */
+int bufcache_flush_ticks = 5 * TIMER_FREQ;
+int bufcache_high_water = 50;
+
+/* Number of entries currently marked dirty. */
+static int dirty_cnt;
+
+/* Set, under cache_lock, when the flusher should run, and signaled
+   along with FLUSH_WANTED. */
+static bool flush_due;
+static struct condition flush_wanted;
+
+/* Sectors waiting to be read ahead, as a ring buffer guarded by
+   cache_lock, with the thread each is for.  Requests that do not fit are
+   dropped. */
+#define RA_QUEUE_SIZE 64
+struct ra_request {
+	block_sector_t sector;
+	tid_t tid;
+};
+static struct ra_request ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head;
+static size_t ra_cnt;
+static struct condition ra_wanted;
+
+/* Cache sizing, settable from the kernel command line.  BUFCACHE_SIZE
+   entries are taken from the kernel pool at boot and kept for good.  The
+   cache then grows towards BUFCACHE_MAX_SIZE entries with pages borrowed
+   from the user pool, and hands them back when a user allocation would
+   otherwise fail. */
+int bufcache_size = 64;
+int bufcache_max_size = 64;
+
+/* Sectors per cache entry, settable with "-cache-unit=SECTORS".  A power
+   of two no larger than SECTORS_PER_PAGE. */
+int bufcache_unit = 1;
+
+static size_t unit_bytes;           /* Bytes of data per entry. */
+static size_t entries_per_page;     /* Entries per chunk. */
+
+/* Soft per-thread quota, in percent of the cache's entries, settable
+   with "-cache-quota=PCT".  A thread that already holds its share
+   replaces its own least recently used entry on a miss instead of
+   taking the policy's victim, so one scanning thread cannot push
+   everyone else out.  0 turns quotas off. */
+int bufcache_quota = 0;
+
+/* The entries charged to one thread: the last thread to load or use
+   each of them.  Exists while it has any. */
+struct owner {
+	tid_t tid;
+	struct hash_elem hash_elem;     /* Element in owner_index. */
+	struct list entries;            /* Most recently used first. */
+	size_t entry_cnt;
 };
 
-int num_accesses;
-int num_hit;
-int wrt_count;
+/* Owners by thread, guarded by cache_lock. */
+static struct hash owner_index;
+
+/* A page of cached sector contents with the entries that describe it.
+   The cache grows and shrinks a whole chunk at a time. */
+struct chunk {
+	struct list_elem elem;          /* Element in chunk_list. */
+	uint8_t *page;                  /* Contents of all the entries. */
+	bool borrowed;                  /* Page is from the user pool. */
+	struct rw_lock locks[SECTORS_PER_PAGE]; /* One per sector of PAGE. */
+	struct metadata entries[];      /* entries_per_page of them. */
+};
 
-static struct data cached_data[NUM_ENTRIES];
+/* All chunks, the ones allocated at boot first. */
+static struct list chunk_list;
 
-static struct metadata entries[NUM_ENTRIES];
+/* Number of entries in the cache. */
+static size_t entry_cnt;
 
+/* Guards the sector index, the LRU list and the bookkeeping fields of every
+   entry.  It is never held while sector contents are copied or while the
+   disk is busy, so accesses to different sectors proceed in parallel. */
 static struct lock cache_lock;
 
 static struct condition until_one_ready;
 
 static struct list lru_list;
 
+/* A replacement policy decides which sector to drop when the cache is
+   full.  Every hook runs with cache_lock held. */
+struct cache_policy {
+	const char *name;
+	void (*init)(void);                 /* Sets up the policy's lists. */
+	void (*add)(struct metadata *);     /* A new, unused entry joins the cache. */
+	void (*remove)(struct metadata *);  /* An unused entry leaves the cache. */
+	void (*admit)(struct metadata *);   /* Entry now holds a new sector. */
+	void (*touch)(struct metadata *);   /* Entry was hit. */
+	void (*forget)(struct metadata *);  /* Entry is about to drop its sector. */
+	struct metadata *(*victim)(void);   /* Evictable entry to reuse, or NULL. */
+	size_t (*hottest)(block_sector_t *, size_t max); /* Lists sectors held,
+														hottest first. */
+};
+
+static const struct cache_policy lru_policy;
+static const struct cache_policy twoq_policy;
+
+/* Policy in use, chosen with the "-cache=POLICY" kernel option. */
+static const struct cache_policy *policy = &lru_policy;
+
+/* Maps a sector number to the entry caching it. */
+static struct hash sector_index;
+
+/* Sectors whose contents on disk are known to be all zeros, so a miss
+   on them needs no device read.  A sector's bit is brought up to date
+   when it leaves the cache; while it is cached, its entry's ZERO_MASK
+   is what counts.  Guarded by cache_lock. */
+static struct bitmap *known_zero;
+
+/* Bounce buffer for merging a partially written entry with the rest of
+   its unit from disk.  FILL_LOCK also guards the written range of every
+   partial entry. */
+static uint8_t fill_buf[PGSIZE];
+static struct lock fill_lock;
+
+/* Bounce buffer for writing back a run of units that are still in use,
+   which are copied out one sector at a time under each sector's
+   data_lock.  Holds the longest run bufcache_flush() writes at once. */
+#define RUN_PAGES 4
+#define RUN_SECTORS (RUN_PAGES * SECTORS_PER_PAGE)
+static uint8_t *back_buf;
+static struct lock back_lock;
+
 struct metadata* bufcache_access(block_sector_t sector, bool blind);
+static size_t chunk_size(void);
+static void add_chunk(struct chunk *chunk, uint8_t *page, bool borrowed);
+static void flusher(void *aux);
+static void flush_ticker(void *aux);
+static void read_ahead(void *aux);
+
+/*Returns the first sector of the unit holding SECTOR*/
+static block_sector_t unit_start(block_sector_t sector) {
+	return sector - sector % bufcache_unit;
+}
+
+/*Returns the offset of SECTOR's data within its unit*/
+static size_t unit_ofs(block_sector_t sector) {
+	return sector % bufcache_unit * BLOCK_SECTOR_SIZE;
+}
+
+/*Returns the number of sectors in the unit starting at START, which is
+  short at the end of the disk*/
+static size_t unit_cnt(block_sector_t start) {
+	block_sector_t left = block_size(fs_device) - start;
+	return left < (block_sector_t) bufcache_unit ? left : (size_t) bufcache_unit;
+}
+
+/*Returns the data_lock for the sector at OFFSET within ENTRY's unit*/
+static struct rw_lock *data_lock(struct metadata *entry, size_t offset) {
+	return &entry->data_locks[offset / BLOCK_SECTOR_SIZE];
+}
+
+/*Loads which sectors of ENTRY's unit are known to be zero on disk.
+  Returns true if all of them are.*/
+static bool load_zero(struct metadata *entry) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	bool all = true;
+	for (size_t i = 0; i < unit_cnt(entry->sector); i++) {
+		entry->zero[i] = bitmap_test(known_zero, entry->sector + i);
+		all = all && entry->zero[i];
+	}
+	return all;
+}
+
+/*Acquires cache_lock, counting the times another thread already held it*/
+static void acquire_cache_lock(void) {
+	if (!lock_try_acquire(&cache_lock)) {
+		lock_acquire(&cache_lock);
+		stats.lock_waits++;
+	}
+}
+
+/*Hashes an entry by the sector it holds*/
+static unsigned sector_hash(const struct hash_elem *e, void *aux UNUSED) {
+	const struct metadata *m = hash_entry(e, struct metadata, hash_elem);
+	return hash_int(m->sector);
+}
+
+/*Orders entries by the sector they hold*/
+static bool sector_less(const struct hash_elem *a, const struct hash_elem *b,
+						void *aux UNUSED) {
+	return hash_entry(a, struct metadata, hash_elem)->sector
+		< hash_entry(b, struct metadata, hash_elem)->sector;
+}
+
+/*Hashes an owner by its thread*/
+static unsigned owner_hash(const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int(hash_entry(e, struct owner, hash_elem)->tid);
+}
+
+/*Orders owners by thread*/
+static bool owner_less(const struct hash_elem *a, const struct hash_elem *b,
+					   void *aux UNUSED) {
+	return hash_entry(a, struct owner, hash_elem)->tid
+		< hash_entry(b, struct owner, hash_elem)->tid;
+}
+
+/*Returns the owner for thread TID, or NULL if it holds no entries*/
+static struct owner *find_owner(tid_t tid) {
+	struct owner key;
+	struct hash_elem *e;
+
+	key.tid = tid;
+	e = hash_find(&owner_index, &key.hash_elem);
+	return e != NULL ? hash_entry(e, struct owner, hash_elem) : NULL;
+}
+
+/*Charges ENTRY to thread TID as its most recently used entry, or to
+  nobody if TID is TID_ERROR. Quotas are soft, so an entry whose owner
+  cannot be allocated simply goes uncharged.*/
+static void set_owner(struct metadata *entry, tid_t tid) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	struct owner *owner = entry->owner;
+
+	if (bufcache_quota == 0)
+		return;
+	if (owner != NULL) {
+		list_remove(&entry->owner_elem);
+		if (owner->tid == tid) {
+			list_push_front(&owner->entries, &entry->owner_elem);
+			return;
+		}
+		if (--owner->entry_cnt == 0) {
+			hash_delete(&owner_index, &owner->hash_elem);
+			free(owner);
+		}
+		entry->owner = NULL;
+	}
+	if (tid == TID_ERROR)
+		return;
+
+	owner = find_owner(tid);
+	if (owner == NULL) {
+		owner = malloc(sizeof *owner);
+		if (owner == NULL)
+			return;
+		owner->tid = tid;
+		list_init(&owner->entries);
+		owner->entry_cnt = 0;
+		hash_insert(&owner_index, &owner->hash_elem);
+	}
+	list_push_front(&owner->entries, &entry->owner_elem);
+	owner->entry_cnt++;
+	entry->owner = owner;
+}
+
+/*Points ENTRY at SECTOR, moving it within the sector index and telling
+  the replacement policy*/
+static void set_sector(struct metadata *entry, block_sector_t sector) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	if (entry->sector != (block_sector_t) INVALID_SECTOR) {
+		stats.evictions++;
+		for (size_t i = 0; i < unit_cnt(entry->sector); i++)
+			bitmap_set(known_zero, entry->sector + i, entry->zero[i]);
+		policy->forget(entry);
+		hash_delete(&sector_index, &entry->hash_elem);
+		set_owner(entry, TID_ERROR);
+	}
+	entry->sector = sector;
+	if (sector != (block_sector_t) INVALID_SECTOR) {
+		hash_insert(&sector_index, &entry->hash_elem);
+		policy->admit(entry);
+	}
+}
+
+/*Returns true if ENTRY may be given to another sector right now*/
+static bool evictable(const struct metadata *entry) {
+	return entry->ready && entry->pin_cnt == 0;
+}
+
+/*Returns the evictable entry closest to the back of LIST, or NULL*/
+static struct metadata *last_evictable(struct list *list) {
+	for (struct list_elem *e = list_rbegin(list); e != list_rend(list);
+		 e = list_prev(e)) {
+		struct metadata *entry = list_entry(e, struct metadata, lru_elem);
+		if (evictable(entry))
+			return entry;
+	}
+	return NULL;
+}
+
+/*Appends the sectors held by the entries of LIST, front first, to the
+  CNT already in SECTORS, stopping at MAX. Returns the new count.*/
+static size_t list_sectors(struct list *list, block_sector_t *sectors,
+						   size_t cnt, size_t max) {
+	for (struct list_elem *e = list_begin(list);
+		 e != list_end(list) && cnt < max; e = list_next(e)) {
+		struct metadata *entry = list_entry(e, struct metadata, lru_elem);
+		if (entry->sector != (block_sector_t) INVALID_SECTOR && entry->ready)
+			sectors[cnt++] = entry->sector;
+	}
+	return cnt;
+}
+
+/*Moves ENTRY to the front of LIST*/
+static void move_to_front(struct list *list, struct metadata *entry) {
+	list_remove(&entry->lru_elem);
+	list_push_front(list, &entry->lru_elem);
+}
+
+/* LRU: a single list, most recently used at the front. */
+
+static void lru_init(void) {
+	list_init(&lru_list);
+}
+
+static void lru_add(struct metadata *entry) {
+	list_push_back(&lru_list, &entry->lru_elem);
+}
+
+static void lru_remove(struct metadata *entry) {
+	list_remove(&entry->lru_elem);
+}
+
+static void lru_touch(struct metadata *entry) {
+	move_to_front(&lru_list, entry);
+}
+
+static void lru_forget(struct metadata *entry UNUSED) {
+}
+
+static struct metadata *lru_victim(void) {
+	return last_evictable(&lru_list);
+}
+
+static size_t lru_hottest(block_sector_t *sectors, size_t max) {
+	return list_sectors(&lru_list, sectors, 0, max);
+}
+
+static const struct cache_policy lru_policy = {
+	"lru", lru_init, lru_add, lru_remove, lru_touch, lru_touch, lru_forget,
+	lru_victim, lru_hottest
+};
+
+/* 2Q (Johnson and Shasha): a sector seen for the first time enters the
+   A1in FIFO, and further hits there do not move it, so one pass over a
+   large file only churns A1in.  Sectors pushed out of A1in leave a ghost
+   (just the sector number) in A1out; a sector that is missed again while
+   its ghost is still there has proven itself and goes to the Am LRU list,
+   which holds the hot set. */
+
+/* A sector recently evicted from A1in. */
+struct ghost {
+	block_sector_t sector;          /* INVALID_SECTOR if unused. */
+	struct hash_elem hash_elem;     /* Element in ghost_index while used. */
+	struct list_elem list_elem;     /* Element in a1out_list. */
+};
+
+static struct list a1in_list;       /* FIFO, newest at the front. */
+static struct list am_list;         /* LRU, most recent at the front. */
+static struct list a1out_list;      /* Ghosts, newest at the front. */
+static struct hash ghost_index;     /* Ghosts in use, by sector. */
+static size_t a1in_cnt;             /* Entries in a1in_list. */
+
+static unsigned ghost_hash(const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int(hash_entry(e, struct ghost, hash_elem)->sector);
+}
+
+static bool ghost_less(const struct hash_elem *a, const struct hash_elem *b,
+					   void *aux UNUSED) {
+	return hash_entry(a, struct ghost, hash_elem)->sector
+		< hash_entry(b, struct ghost, hash_elem)->sector;
+}
+
+static void twoq_init(void) {
+	size_t ghost_cnt = bufcache_max_size / bufcache_unit / 2;
+	if (ghost_cnt == 0)
+		ghost_cnt = 1;
+	struct ghost *ghosts = malloc(ghost_cnt * sizeof *ghosts);
+	if (ghosts == NULL)
+		PANIC("cannot allocate 2Q ghost list");
+
+	list_init(&a1in_list);
+	list_init(&am_list);
+	list_init(&a1out_list);
+	hash_init(&ghost_index, ghost_hash, ghost_less, NULL);
+	for (size_t i = 0; i < ghost_cnt; i++) {
+		ghosts[i].sector = INVALID_SECTOR;
+		list_push_back(&a1out_list, &ghosts[i].list_elem);
+	}
+	a1in_cnt = 0;
+}
+
+static void twoq_add(struct metadata *entry) {
+	entry->hot = false;
+	list_push_back(&a1in_list, &entry->lru_elem);
+	a1in_cnt++;
+}
+
+static void twoq_remove(struct metadata *entry) {
+	list_remove(&entry->lru_elem);
+	if (!entry->hot)
+		a1in_cnt--;
+}
+
+/*Removes the ghost of SECTOR, returning true if there was one*/
+static bool take_ghost(block_sector_t sector) {
+	struct ghost key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_delete(&ghost_index, &key.hash_elem);
+	if (e == NULL)
+		return false;
+	struct ghost *ghost = hash_entry(e, struct ghost, hash_elem);
+	ghost->sector = INVALID_SECTOR;
+	list_remove(&ghost->list_elem);
+	list_push_back(&a1out_list, &ghost->list_elem);
+	return true;
+}
+
+static void twoq_admit(struct metadata *entry) {
+	list_remove(&entry->lru_elem);
+	if (!entry->hot)
+		a1in_cnt--;
+	entry->hot = take_ghost(entry->sector);
+	if (entry->hot) {
+		list_push_front(&am_list, &entry->lru_elem);
+	} else {
+		list_push_front(&a1in_list, &entry->lru_elem);
+		a1in_cnt++;
+	}
+}
+
+static void twoq_touch(struct metadata *entry) {
+	if (entry->hot)
+		move_to_front(&am_list, entry);
+}
+
+/*Leaves a ghost for a sector leaving A1in, reusing the oldest ghost*/
+static void twoq_forget(struct metadata *entry) {
+	if (entry->hot)
+		return;
+	struct ghost *ghost = list_entry(list_back(&a1out_list), struct ghost,
+									 list_elem);
+	if (ghost->sector != (block_sector_t) INVALID_SECTOR)
+		hash_delete(&ghost_index, &ghost->hash_elem);
+	ghost->sector = entry->sector;
+	list_remove(&ghost->list_elem);
+	list_push_front(&a1out_list, &ghost->list_elem);
+	if (hash_insert(&ghost_index, &ghost->hash_elem) != NULL) {
+		ghost->sector = INVALID_SECTOR;
+		list_remove(&ghost->list_elem);
+		list_push_back(&a1out_list, &ghost->list_elem);
+	}
+}
+
+static struct metadata *twoq_victim(void) {
+	struct metadata *victim = NULL;
+	/* A1in takes a quarter of the cache; it only grows past that when
+	   Am cannot give up an entry. */
+	if (a1in_cnt > entry_cnt / 4)
+		victim = last_evictable(&a1in_list);
+	if (victim == NULL)
+		victim = last_evictable(&am_list);
+	if (victim == NULL)
+		victim = last_evictable(&a1in_list);
+	return victim;
+}
+
+/* Entries that earned a place in Am come before those only seen once. */
+static size_t twoq_hottest(block_sector_t *sectors, size_t max) {
+	size_t cnt = list_sectors(&am_list, sectors, 0, max);
+	return list_sectors(&a1in_list, sectors, cnt, max);
+}
+
+static const struct cache_policy twoq_policy = {
+	"2q", twoq_init, twoq_add, twoq_remove, twoq_admit, twoq_touch,
+	twoq_forget, twoq_victim, twoq_hottest
+};
+
+/*Selects the replacement policy called NAME for bufcache_init() to use.
+  Returns false if there is no such policy.*/
+bool bufcache_set_policy(const char *name) {
+	static const struct cache_policy *policies[] = {&lru_policy, &twoq_policy};
+
+	for (size_t i = 0; name != NULL && i < sizeof policies / sizeof *policies; i++) {
+		if (!strcmp(name, policies[i]->name)) {
+			policy = policies[i];
+			return true;
+		}
+	}
+	return false;
+}
 
 void bufcache_init(void) {
-  list_init(&lru_list);
+  hash_init(&sector_index, sector_hash, sector_less, NULL);
+  hash_init(&owner_index, owner_hash, owner_less, NULL);
   lock_init(&cache_lock);
   cond_init(&until_one_ready);
-  num_hit = 0;
-  num_accesses = 0;
-  wrt_count = 0;
-  for (int i = 0; i < NUM_ENTRIES; i++) {
-    entries[i].entry = &cached_data[i];
-    entries[i].dirty = false;
-    entries[i].ready = true;
-    entries[i].sector = INVALID_SECTOR;
-    cond_init(&entries[i].until_ready);
-    list_push_front(&lru_list, &entries[i].lru_elem);
+  memset(&stats, 0, sizeof stats);
+  memset(&stats_at_reset, 0, sizeof stats_at_reset);
+  fill_bytes = 0;
+  dirty_cnt = 0;
+  flush_due = false;
+  cond_init(&flush_wanted);
+  cond_init(&ra_wanted);
+  ra_head = ra_cnt = 0;
+  list_init(&chunk_list);
+  entry_cnt = 0;
+  lock_init(&fill_lock);
+  lock_init(&back_lock);
+  back_buf = palloc_get_multiple(PAL_ASSERT, RUN_PAGES);
+  if (bufcache_unit < 1 || bufcache_unit > SECTORS_PER_PAGE
+      || (bufcache_unit & (bufcache_unit - 1)) != 0)
+    PANIC("cache unit must be a power of 2 up to %d sectors", SECTORS_PER_PAGE);
+  unit_bytes = bufcache_unit * BLOCK_SECTOR_SIZE;
+  entries_per_page = SECTORS_PER_PAGE / bufcache_unit;
+  known_zero = bitmap_create(block_size(fs_device));
+  if (known_zero == NULL)
+    PANIC("cannot allocate buffer cache");
+
+  if (bufcache_size < SECTORS_PER_PAGE)
+    bufcache_size = SECTORS_PER_PAGE;
+  if (bufcache_max_size < bufcache_size)
+    bufcache_max_size = bufcache_size;
+  policy->init();
+
+  size_t page_cnt = DIV_ROUND_UP(bufcache_size, SECTORS_PER_PAGE);
+  uint8_t *pages = palloc_get_multiple(PAL_ASSERT, page_cnt);
+  for (size_t i = 0; i < page_cnt; i++) {
+    struct chunk *chunk = malloc(chunk_size());
+    if (chunk == NULL)
+      PANIC("cannot allocate buffer cache");
+    add_chunk(chunk, pages + i * PGSIZE, false);
   }
+  thread_create("bufcache-flush", PRI_DEFAULT, flusher, NULL, NULL);
+  if (bufcache_flush_ticks > 0)
+    thread_create("bufcache-tick", PRI_DEFAULT, flush_ticker, NULL, NULL);
+  thread_create("bufcache-ra", PRI_DEFAULT, read_ahead, NULL, NULL);
 }
 
-/*Find which entry to remove, picking the one closest to the back of the LRU list*/
-static struct metadata* get_eviction_candidate(void) {
+/*Returns the size of a chunk with its entries*/
+static size_t chunk_size(void) {
+	return sizeof(struct chunk) + entries_per_page * sizeof(struct metadata);
+}
+
+/*Puts CHUNK, whose contents live in PAGE, into the cache as unused entries*/
+static void add_chunk(struct chunk *chunk, uint8_t *page, bool borrowed) {
+	chunk->page = page;
+	chunk->borrowed = borrowed;
+	for (int i = 0; i < SECTORS_PER_PAGE; i++)
+		rw_lock_init(&chunk->locks[i]);
+	for (size_t i = 0; i < entries_per_page; i++) {
+		struct metadata *entry = &chunk->entries[i];
+		entry->contents = page + i * unit_bytes;
+		entry->data_locks = &chunk->locks[i * bufcache_unit];
+		entry->dirty = false;
+		entry->ready = true;
+		entry->sector = INVALID_SECTOR;
+		entry->pin_cnt = 0;
+		entry->prefetched = false;
+		entry->owner = NULL;
+		entry->partial = false;
+		cond_init(&entry->until_ready);
+		policy->add(entry);
+	}
+	list_push_back(&chunk_list, &chunk->elem);
+	entry_cnt += entries_per_page;
+}
+
+/*Called when ENTRY is about to hold a different sector; a prefetched block
+  that nobody read was wasted read-ahead*/
+static void forget_prefetch(struct metadata *entry) {
+	if (entry->prefetched) {
+		stats.readahead_wasted++;
+		entry->prefetched = false;
+	}
+}
+
+/*Wakes the flusher. The caller must hold cache_lock*/
+static void wake_flusher(void) {
 	ASSERT(lock_held_by_current_thread(&cache_lock));
-	struct metadata *metadata;
-	for(struct list_elem *e = list_rbegin(&lru_list); e != list_rend(&lru_list);
-		e = list_prev(e)) {
-		metadata = list_entry(e, struct metadata, lru_elem);
-		if (metadata->ready == true) {
-			return metadata;
-		}
+	if (!flush_due) {
+		flush_due = true;
+		cond_signal(&flush_wanted, &cache_lock);
+	}
+}
+
+/*Marks ENTRY dirty or clean, keeping count of the dirty entries, and wakes
+  the flusher once they pass the high-water mark*/
+static void set_dirty(struct metadata *entry, bool dirty) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	if (entry->dirty != dirty)
+		dirty_cnt += dirty ? 1 : -1;
+	entry->dirty = dirty;
+	if (dirty && dirty_cnt * 100 > (int) entry_cnt * bufcache_high_water)
+		wake_flusher();
+}
+
+/*Borrows a page from the user pool for another chunk of entries, as long as
+  the cache is below its maximum size and user processes can spare the
+  memory. Returns true if the cache grew.*/
+static bool grow(void) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	if ((entry_cnt + entries_per_page) * bufcache_unit > (size_t) bufcache_max_size
+		|| palloc_free_cnt(PAL_USER) <= USER_RESERVE_PAGES)
+		return false;
+
+	struct chunk *chunk = malloc(chunk_size());
+	uint8_t *page = palloc_get_page(PAL_USER);
+	if (chunk == NULL || page == NULL) {
+		free(chunk);
+		if (page != NULL)
+			palloc_free_page(page);
+		return false;
 	}
+	add_chunk(chunk, page, true);
+	return true;
+}
 
+/*Returns a borrowed chunk none of whose entries are in use, or NULL*/
+static struct chunk *idle_chunk(void) {
+	for (struct list_elem *e = list_rbegin(&chunk_list);
+		 e != list_rend(&chunk_list); e = list_prev(e)) {
+		struct chunk *chunk = list_entry(e, struct chunk, elem);
+		size_t i;
+
+		if (!chunk->borrowed)
+			break;
+		for (i = 0; i < entries_per_page; i++)
+			if (!evictable(&chunk->entries[i]))
+				break;
+		if (i == entries_per_page)
+			return chunk;
+	}
 	return NULL;
 }
 
-/*Find an entry in the list of metadata structs*/
-static struct metadata* find(block_sector_t sector) {
+/*Drops the clean, idle CHUNK from the cache and returns its page*/
+static void remove_chunk(struct chunk *chunk) {
+	for (size_t i = 0; i < entries_per_page; i++) {
+		struct metadata *entry = &chunk->entries[i];
+		ASSERT(evictable(entry) && !entry->dirty);
+		forget_prefetch(entry);
+		set_sector(entry, INVALID_SECTOR);
+		policy->remove(entry);
+	}
+	list_remove(&chunk->elem);
+	entry_cnt -= entries_per_page;
+	palloc_free_page(chunk->page);
+	free(chunk);
+}
+
+/*Find which entry to remove, as chosen by the replacement policy.
+  Entries that are pinned or in the middle of I/O cannot be evicted.*/
+static struct metadata* get_eviction_candidate(void) {
 	ASSERT(lock_held_by_current_thread(&cache_lock));
+	return policy->victim();
+}
 
-	for (int i = 0; i < NUM_ENTRIES; i++) {
-		if (entries[i].sector == sector) {
-			return &entries[i];
-		}
+/*Returns true if OWNER holds at least its quota of the cache*/
+static bool over_quota(const struct owner *owner) {
+	return owner->entry_cnt * 100 >= entry_cnt * bufcache_quota;
+}
+
+/*Returns thread TID's least recently used evictable entry if the thread
+  is at or over its quota and the policy's victim belongs to another
+  thread that is within its own, otherwise NULL. The quota is soft: a
+  thread may keep more than its share as long as nobody else needs it.*/
+static struct metadata *quota_victim(tid_t tid) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	struct owner *owner;
+	struct metadata *victim;
+
+	if (bufcache_quota == 0 || (owner = find_owner(tid)) == NULL
+		|| !over_quota(owner))
+		return NULL;
+	victim = policy->victim();
+	if (victim == NULL || victim->owner == NULL || victim->owner == owner
+		|| over_quota(victim->owner))
+		return NULL;
+	for (struct list_elem *e = list_rbegin(&owner->entries);
+		 e != list_rend(&owner->entries); e = list_prev(e)) {
+		struct metadata *entry = list_entry(e, struct metadata, owner_elem);
+		if (evictable(entry))
+			return entry;
 	}
 	return NULL;
 }
 
-/*Write contents of the bufcache entry back to disk*/
+/*Find the entry holding SECTOR through the sector index*/
+static struct metadata* find(block_sector_t sector) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	struct metadata key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_find(&sector_index, &key.hash_elem);
+	return e != NULL ? hash_entry(e, struct metadata, hash_elem) : NULL;
+}
+
+/*Makes all of ENTRY's contents valid. A write that missed the cache only
+  put its own bytes in the entry; the rest of the unit is read in around
+  them now. Only bytes outside the written range change, which nobody
+  reads, so the caller needs only to hold fill_lock.*/
+static void fill_locked(struct metadata *entry) {
+	ASSERT(lock_held_by_current_thread(&fill_lock));
+	block_read_multiple(fs_device, entry->sector, unit_cnt(entry->sector), fill_buf);
+	memcpy(entry->contents, fill_buf, entry->valid_start);
+	memcpy(&entry->contents[entry->valid_end], &fill_buf[entry->valid_end],
+		   unit_bytes - entry->valid_end);
+	entry->partial = false;
+	fill_bytes += unit_cnt(entry->sector) * BLOCK_SECTOR_SIZE;
+}
+
+/*Makes all of ENTRY's contents valid, if they are not already. A pinned
+  entry never becomes partial again, so PARTIAL is safe to test first.*/
+static void fill_partial(struct metadata *entry) {
+	if (!entry->partial)
+		return;
+	lock_acquire(&fill_lock);
+	if (entry->partial)
+		fill_locked(entry);
+	lock_release(&fill_lock);
+}
+
+/*Adds OFFSET...OFFSET+LENGTH to the written range of partial ENTRY if the
+  two touch, so that a run of small appends fills the unit without ever
+  reading it. Returns false if they do not.*/
+static bool combine(struct metadata *entry, size_t offset, size_t length) {
+	if (offset > entry->valid_end || offset + length < entry->valid_start)
+		return false;
+	if (offset < entry->valid_start)
+		entry->valid_start = offset;
+	if (offset + length > entry->valid_end)
+		entry->valid_end = offset + length;
+	if (entry->valid_start == 0 && entry->valid_end == unit_bytes)
+		entry->partial = false;
+	return true;
+}
+
+/*Acquires the data_lock for reading bytes OFFSET...OFFSET+LENGTH of ENTRY,
+  which lie within one sector, first filling the entry in if it was left
+  partial without them.*/
+static void acquire_read(struct metadata *entry, size_t offset, size_t length) {
+	rw_lock_acquire_read(data_lock(entry, offset));
+	if (entry->partial) {
+		lock_acquire(&fill_lock);
+		if (entry->partial && (offset < entry->valid_start
+							   || offset + length > entry->valid_end))
+			fill_locked(entry);
+		lock_release(&fill_lock);
+	}
+}
+
+/*Acquires the data_lock for overwriting bytes OFFSET...OFFSET+LENGTH of
+  ENTRY, which lie within one sector. A partial entry takes them into its
+  written range if it can, and is filled in otherwise.*/
+static void acquire_write(struct metadata *entry, size_t offset, size_t length) {
+	rw_lock_acquire_write(data_lock(entry, offset));
+	if (entry->partial) {
+		lock_acquire(&fill_lock);
+		if (entry->partial && !combine(entry, offset, length))
+			fill_locked(entry);
+		lock_release(&fill_lock);
+	}
+}
+
+/*Write contents of an unpinned bufcache entry back to disk so it can be evicted*/
 static void clean(struct metadata *entry) {
   ASSERT(lock_held_by_current_thread(&cache_lock));
   ASSERT(entry->dirty);
+  ASSERT(entry->pin_cnt == 0);
   entry->ready = false;
   lock_release(&cache_lock);
-  block_write(fs_device, entry->sector, entry->entry->contents);
-  lock_acquire(&cache_lock);
-  num_accesses++;
-  wrt_count++;
+  fill_partial(entry);
+  block_write_multiple(fs_device, entry->sector, unit_cnt(entry->sector),
+                       entry->contents);
+  acquire_cache_lock();
+  stats.write_backs++;
   entry->ready = true;
-  entry->dirty = false;
+  set_dirty(entry, false);
   cond_broadcast(&entry->until_ready, &cache_lock);
   cond_broadcast(&until_one_ready, &cache_lock);
 }
 
-/*Replaces an entry in the LRU list*/
+/*Replaces an entry in the LRU list, loading the unit starting at SECTOR.
+  Units known to be zero on disk are filled in without reading them.*/
 static void replace(struct metadata *entry, block_sector_t sector) {
   ASSERT(lock_held_by_current_thread(&cache_lock));
   ASSERT(!(entry->dirty));
-  entry->sector = sector;
+  forget_prefetch(entry);
+  set_sector(entry, sector);
   entry->ready = false;
+  entry->partial = false;
+  bool zero = load_zero(entry);
   lock_release(&cache_lock);
-  block_read(fs_device, entry->sector, entry->entry->contents);
-  lock_acquire(&cache_lock);
-  num_accesses++;
+  if (zero)
+    memset(entry->contents, 0, unit_bytes);
+  else
+    block_read_multiple(fs_device, sector, unit_cnt(sector), entry->contents);
+  acquire_cache_lock();
+  if (!zero)
+    stats.bytes_read += unit_cnt(sector) * BLOCK_SECTOR_SIZE;
   entry->ready = true;
   cond_broadcast(&entry->until_ready, &cache_lock);
   cond_broadcast(&until_one_ready, &cache_lock);
 }
 
+/*Drops the caller's pin on ENTRY, marking it dirty if the caller changed it.
+  A blind write claims its entry before the contents are valid, so the
+  entry only becomes ready once that write has been copied in.*/
+static void release_entry(struct metadata *entry, bool dirty) {
+	acquire_cache_lock();
+	if (dirty)
+		set_dirty(entry, true);
+	if (!entry->ready) {
+		entry->ready = true;
+		cond_broadcast(&entry->until_ready, &cache_lock);
+	}
+	if (--entry->pin_cnt == 0)
+		cond_broadcast(&until_one_ready, &cache_lock);
+	lock_release(&cache_lock);
+}
+
 /*Reads a sector, which it finds by calling bufcache access*/
 void bufcache_read(block_sector_t sector, void *buffer,
 				   size_t offset, size_t length) {
 	ASSERT(offset + length <= BLOCK_SECTOR_SIZE);
+	offset += unit_ofs(sector);
 
-	lock_acquire(&cache_lock);
-	struct metadata *entry = bufcache_access(sector, false);
-	num_accesses++;
-	memcpy(buffer, &entry->entry->contents[offset], length);
+	acquire_cache_lock();
+	struct metadata *entry = bufcache_access(unit_start(sector), false);
 	lock_release(&cache_lock);
+
+	acquire_read(entry, offset, length);
+	memcpy(buffer, &entry->contents[offset], length);
+	rw_lock_release_read(data_lock(entry, offset));
+	release_entry(entry, false);
 }
 
 /*Scans the bufcache for a specific block, and if it cannot find it, will
   call get_eviction_candidate to make room for a new one, which it pulls
 	in from disk. If it can find the block in the bufcache, it will move it
-	to the front of the lru list.*/
+	to the front of the replacement policy's lists. The entry is returned pinned, so it stays
+	in the cache after cache_lock is dropped until release_entry() is called.
+	A blind access returns a freshly claimed entry that is not ready yet, in
+	place of reading the sector; the caller must fill it in, or mark what it
+	wrote with the entry's partial range, before releasing it.*/
 struct metadata* bufcache_access(block_sector_t sector, bool blind){
 	ASSERT(lock_held_by_current_thread(&cache_lock));
+	tid_t tid = thread_current()->tid;
+	bool missed = false;
 	while(1){
 		struct metadata* match = find(sector);
 		if(match != NULL){
 			if(!match->ready){
+				stats.ready_waits++;
 				cond_wait(&match->until_ready, &cache_lock);
 				continue;
 			}
-			// push to the front of the lru_list
-			num_hit++;
-			list_remove(&match->lru_elem);
-			list_push_front(&lru_list,&match->lru_elem);
+			if(!missed)
+				stats.hits++;
+			if(match->prefetched){
+				stats.readahead_used++;
+				match->prefetched = false;
+			}
+			policy->touch(match);
+			set_owner(match, tid);
+			match->pin_cnt++;
 			return match;
 		}
-		struct metadata* to_evict = get_eviction_candidate();
-		if(to_evict == NULL){
+		struct metadata* to_evict = quota_victim(tid);
+		bool own = to_evict != NULL;
+		if(!own)
+			to_evict = get_eviction_candidate();
+		if(!own && (to_evict == NULL || to_evict->sector != (block_sector_t) INVALID_SECTOR)
+		   && grow()){
+			// the new entries are unused, so the next candidate is free
+		} else if(to_evict == NULL){
+			stats.victim_waits++;
 			cond_wait(&until_one_ready, &cache_lock);
 		} else if(to_evict->dirty){
 			clean(to_evict);
 		} else if(blind){
-			// make it to ignore this iteration.
-			// on the next iteration, find() should succeed
-			to_evict->sector = sector;
+			// nobody else may see the old contents under the new sector
+			forget_prefetch(to_evict);
+			set_sector(to_evict, sector);
+			set_owner(to_evict, tid);
+			to_evict->ready = false;
+			to_evict->pin_cnt++;
+			stats.misses++;
+			stats.blind_writes++;
+			return to_evict;
 		} else {
 			replace(to_evict,sector);
+			set_owner(to_evict, tid);
+			stats.misses++;
+			missed = true;
 			// on the next iteration, find() should succeesd
 		}
 	}
 }
 
+/*Copies LENGTH bytes from BUFFER into SECTOR at OFFSET, or zeros the whole
+  sector if BUFFER is null. A write that misses the cache never reads the
+  unit: it claims an entry and records which bytes it wrote, and the rest
+  is only read in if someone needs it.*/
+static void write_sector(block_sector_t sector, const void *buffer,
+						 size_t offset, size_t length) {
+	ASSERT(offset+length <= BLOCK_SECTOR_SIZE);
+	bool zero = false;
+
+	acquire_cache_lock();
+	struct metadata *entry = bufcache_access(unit_start(sector), true);
+	bool claimed = !entry->ready;
+	if (claimed) {
+		zero = load_zero(entry);
+		entry->partial = false;
+	}
+	lock_release(&cache_lock);
+
+	offset += unit_ofs(sector);
+	if (claimed) {
+		// nobody else can see the entry until release_entry() marks it ready
+		if (zero)
+			memset(entry->contents, 0, unit_bytes);
+		else {
+			entry->partial = true;
+			entry->valid_start = offset;
+			entry->valid_end = offset + length;
+			combine(entry, offset, length);
+		}
+	} else
+		acquire_write(entry, offset, length);
+	if (buffer != NULL)
+		memcpy(&entry->contents[offset], buffer, length);
+	else
+		memset(&entry->contents[offset], 0, length);
+	entry->zero[offset / BLOCK_SECTOR_SIZE] = buffer == NULL;
+	if (!claimed)
+		rw_lock_release_write(data_lock(entry, offset));
+	release_entry(entry, true);
+}
+
 /*Writes into a sector, which it finds the entry for using bufcache access.
   If the entry was not marked dirty before, it is marked dirty after the write.*/
-void bufcache_write(block_sector_t sector, void* buffer, size_t offset, size_t length){
-	ASSERT(offset+length <= BLOCK_SECTOR_SIZE);
-	lock_acquire(&cache_lock);
-	struct metadata *entry = bufcache_access(sector, length== BLOCK_SECTOR_SIZE);
-	memcpy(&entry->entry->contents[offset], buffer, length);
-	num_accesses++;
-	entry->dirty = true;
+void bufcache_write(block_sector_t sector, const void *buffer, size_t offset, size_t length){
+	ASSERT(buffer != NULL);
+	write_sector(sector, buffer, offset, length);
+}
+
+/*Fills SECTOR with zeros, for a sector that was just allocated. Neither
+  this nor a later miss on the sector reads it from disk, as long as
+  nothing else is written to it.*/
+void bufcache_zero(block_sector_t sector) {
+	write_sector(sector, NULL, 0, BLOCK_SECTOR_SIZE);
+}
+
+/*Pins SECTOR in the cache and returns its contents in place, without the
+  copy bufcache_read() makes. With WRITE the caller may change the contents
+  and has the sector to itself; otherwise other readers may share it. The
+  entry cannot be evicted until bufcache_unpin(SECTOR, WRITE) is called.
+  A thread must not pin a sector it already has pinned.*/
+void *bufcache_pin(block_sector_t sector, bool write) {
+	size_t offset = unit_ofs(sector);
+
+	acquire_cache_lock();
+	struct metadata *entry = bufcache_access(unit_start(sector), false);
+	lock_release(&cache_lock);
+
+	if (write) {
+		/*The caller reads what it modifies, so a partial entry must be
+		  filled in; combine() is only right for a real overwrite.*/
+		rw_lock_acquire_write(data_lock(entry, offset));
+		fill_partial(entry);
+		entry->zero[offset / BLOCK_SECTOR_SIZE] = false;
+	} else {
+		acquire_read(entry, offset, BLOCK_SECTOR_SIZE);
+	}
+	return &entry->contents[offset];
+}
+
+/*Releases a pin taken by bufcache_pin(SECTOR, WRITE). A write pin leaves
+  the sector dirty.*/
+void bufcache_unpin(block_sector_t sector, bool write) {
+	acquire_cache_lock();
+	struct metadata *entry = find(unit_start(sector));
 	lock_release(&cache_lock);
+	ASSERT(entry != NULL && entry->pin_cnt > 0);
+
+	if (write)
+		rw_lock_release_write(data_lock(entry, unit_ofs(sector)));
+	else
+		rw_lock_release_read(data_lock(entry, unit_ofs(sector)));
+	release_entry(entry, write);
+}
+
+/* Sectors bufcache_read_direct() and bufcache_write_direct() transfer
+   with one device command, at most. */
+#define DIRECT_BATCH 64
+
+/*Returns how many sectors a direct transfer handles at once. A batch
+  may pin every entry it overlaps, so it is kept to a quarter of the
+  cache to leave the rest free for other threads' misses.*/
+static size_t direct_batch(void) {
+	size_t batch = bufcache_max_size / 4;
+	if (batch > DIRECT_BATCH)
+		batch = DIRECT_BATCH;
+	return batch > 0 ? batch : 1;
+}
+
+/*Returns the entry for the unit starting at SECTOR pinned, waiting for
+  it to become ready, or NULL if the unit is not in the cache. Unlike
+  bufcache_access() this never claims or loads an entry, so a thread
+  that already holds pins cannot end up waiting for a free one.*/
+static struct metadata *pin_resident(block_sector_t sector) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	while (1) {
+		struct metadata *entry = find(sector);
+		if (entry == NULL)
+			return NULL;
+		if (entry->ready) {
+			entry->pin_cnt++;
+			return entry;
+		}
+		stats.ready_waits++;
+		cond_wait(&entry->until_ready, &cache_lock);
+	}
+}
+
+/*Pins each cached unit among SECTOR...SECTOR+CNT-1 and takes the data_lock
+  of every one of those sectors it holds, for writing if WRITE, so that none
+  of them changes, is written back or is evicted during a direct transfer.
+  Stores each sector's entry, or NULL if it is not cached, in ENTRIES. The
+  only other holders of two data_locks at once are extent leaf updates,
+  which never lock file data, so this cannot deadlock.*/
+static void lock_cached(block_sector_t sector, size_t cnt,
+						struct metadata **entries, bool write) {
+	for (size_t i = 0; i < cnt; i++) {
+		block_sector_t start = unit_start(sector + i);
+		size_t offset = unit_ofs(sector + i);
+		struct metadata *entry = NULL;
+
+		if (i > 0 && entries[i - 1] != NULL && entries[i - 1]->sector == start)
+			entry = entries[i - 1];
+		else {
+			acquire_cache_lock();
+			entry = pin_resident(start);
+			lock_release(&cache_lock);
+		}
+		entries[i] = entry;
+		if (entry == NULL)
+			continue;
+		if (write)
+			acquire_write(entry, offset, BLOCK_SECTOR_SIZE);
+		else
+			acquire_read(entry, offset, BLOCK_SECTOR_SIZE);
+	}
+}
+
+/*Releases what lock_cached(SECTOR, CNT, ENTRIES, WRITE) took, leaving the
+  entries dirty if WRITE*/
+static void unlock_cached(block_sector_t sector, size_t cnt,
+						  struct metadata **entries, bool write) {
+	for (size_t i = 0; i < cnt; i++) {
+		struct metadata *entry = entries[i];
+		if (entry == NULL)
+			continue;
+		if (write)
+			rw_lock_release_write(data_lock(entry, unit_ofs(sector + i)));
+		else
+			rw_lock_release_read(data_lock(entry, unit_ofs(sector + i)));
+		if (i + 1 == cnt || entries[i + 1] != entry)
+			release_entry(entry, write);
+	}
+}
+
+/*Reads CNT consecutive sectors starting at SECTOR into BUFFER without
+  bringing them into the cache, for transfers large enough that caching
+  them would only push out other data. Each direct_batch() sectors take
+  one device command. Sectors the cache holds are locked for the duration and
+  copied from their entries, which may be newer than the disk.*/
+void bufcache_read_direct(block_sector_t sector, size_t cnt, void *buffer_) {
+	struct metadata *entries[DIRECT_BATCH];
+	uint8_t *buffer = buffer_;
+	size_t batch = direct_batch();
+
+	while (cnt > 0) {
+		size_t n = cnt < batch ? cnt : batch;
+
+		lock_cached(sector, n, entries, false);
+		block_read_multiple(fs_device, sector, n, buffer);
+		for (size_t i = 0; i < n; i++)
+			if (entries[i] != NULL)
+				memcpy(buffer + i * BLOCK_SECTOR_SIZE,
+					   &entries[i]->contents[unit_ofs(sector + i)],
+					   BLOCK_SECTOR_SIZE);
+		unlock_cached(sector, n, entries, false);
+
+		acquire_cache_lock();
+		stats.bytes_read += n * BLOCK_SECTOR_SIZE;
+		lock_release(&cache_lock);
+		sector += n;
+		buffer += n * BLOCK_SECTOR_SIZE;
+		cnt -= n;
+	}
 }
 
-/*Writes all dirty entries back to disk. Does not clear them out.*/
+/*Writes CNT consecutive sectors starting at SECTOR from BUFFER, bypassing
+  the cache like bufcache_read_direct(). Sectors the cache holds are
+  locked and updated through it before the device command, and left
+  dirty, so a write-back of an older copy racing with the transfer is
+  written over again later. A sector loaded into the cache during the
+  transfer is updated afterwards, since it may hold what was on disk
+  before.*/
+void bufcache_write_direct(block_sector_t sector, size_t cnt,
+						   const void *buffer_) {
+	struct metadata *entries[DIRECT_BATCH];
+	const uint8_t *buffer = buffer_;
+	size_t batch = direct_batch();
+
+	while (cnt > 0) {
+		size_t n = cnt < batch ? cnt : batch;
+
+		acquire_cache_lock();
+		bitmap_set_multiple(known_zero, sector, n, false);
+		lock_release(&cache_lock);
+
+		lock_cached(sector, n, entries, true);
+		for (size_t i = 0; i < n; i++)
+			if (entries[i] != NULL) {
+				size_t offset = unit_ofs(sector + i);
+				memcpy(&entries[i]->contents[offset],
+					   buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+				entries[i]->zero[offset / BLOCK_SECTOR_SIZE] = false;
+			}
+		block_write_multiple(fs_device, sector, n, buffer);
+		unlock_cached(sector, n, entries, true);
+
+		for (size_t i = 0; i < n; i++)
+			if (entries[i] == NULL) {
+				acquire_cache_lock();
+				bool cached = find(unit_start(sector + i)) != NULL;
+				lock_release(&cache_lock);
+				if (cached)
+					write_sector(sector + i, buffer + i * BLOCK_SECTOR_SIZE,
+								 0, BLOCK_SECTOR_SIZE);
+			}
+		sector += n;
+		buffer += n * BLOCK_SECTOR_SIZE;
+		cnt -= n;
+	}
+}
+
+/*Writes the CNT dirty entries in RUN, which hold consecutive units, back
+  to disk with one command while leaving them in the cache. Readers keep
+  using the entries during the write; a writer that changes one meanwhile
+  marks it dirty again when it is done. Each sector is copied out under
+  its own data_lock, since taking them all at once could deadlock with a
+  thread that holds one and wants another.*/
+static void write_run(struct metadata **run, size_t cnt) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	block_sector_t first = run[0]->sector;
+	size_t sectors = 0;
+
+	for (size_t i = 0; i < cnt; i++) {
+		ASSERT(run[i]->ready && run[i]->dirty);
+		ASSERT(run[i]->sector == first + sectors);
+		set_dirty(run[i], false);
+		run[i]->pin_cnt++;
+		sectors += unit_cnt(run[i]->sector);
+	}
+	ASSERT(sectors <= RUN_SECTORS);
+	lock_release(&cache_lock);
+
+	if (sectors == 1) {
+		acquire_read(run[0], 0, BLOCK_SECTOR_SIZE);
+		block_write(fs_device, first, run[0]->contents);
+		rw_lock_release_read(data_lock(run[0], 0));
+	} else {
+		lock_acquire(&back_lock);
+		for (size_t i = 0; i < cnt; i++) {
+			struct metadata *entry = run[i];
+			uint8_t *dst = &back_buf[(entry->sector - first) * BLOCK_SECTOR_SIZE];
+			for (size_t ofs = 0; ofs < unit_cnt(entry->sector) * BLOCK_SECTOR_SIZE;
+				 ofs += BLOCK_SECTOR_SIZE) {
+				acquire_read(entry, ofs, BLOCK_SECTOR_SIZE);
+				memcpy(&dst[ofs], &entry->contents[ofs], BLOCK_SECTOR_SIZE);
+				rw_lock_release_read(data_lock(entry, ofs));
+			}
+		}
+		block_write_multiple(fs_device, first, sectors, back_buf);
+		lock_release(&back_lock);
+	}
+
+	acquire_cache_lock();
+	stats.write_backs += cnt;
+	for (size_t i = 0; i < cnt; i++)
+		if (--run[i]->pin_cnt == 0)
+			cond_broadcast(&until_one_ready, &cache_lock);
+}
+
+/* Dirty sectors bufcache_flush() can sort on the stack if it cannot
+   allocate room for all of them. */
+#define FLUSH_BATCH 64
+
+/*Orders sector numbers ascending*/
+static int sector_compare(const void *a_, const void *b_) {
+	const block_sector_t *a = a_;
+	const block_sector_t *b = b_;
+	return *a < *b ? -1 : *a > *b;
+}
+
+/*Writes all dirty entries back to disk in ascending sector order, so the
+  disk sweeps once across the dirty set, with each run of consecutive
+  dirty units going out as a single command. Does not clear them out.*/
 void bufcache_flush(void){
-	lock_acquire(&cache_lock);
-	for(int i=0; i < NUM_ENTRIES; i++){
-		if(entries[i].dirty){
-			clean(&entries[i]);
+	block_sector_t batch[FLUSH_BATCH];
+	block_sector_t *sectors;
+	size_t max, cnt = 0;
+
+	acquire_cache_lock();
+	max = entry_cnt;
+	sectors = malloc(max * sizeof *sectors);
+	if (sectors == NULL) {
+		sectors = batch;
+		max = FLUSH_BATCH;
+	}
+	for (struct list_elem *e = list_begin(&chunk_list);
+		 e != list_end(&chunk_list); e = list_next(e)) {
+		struct chunk *chunk = list_entry(e, struct chunk, elem);
+		for (size_t i = 0; i < entries_per_page && cnt < max; i++) {
+			struct metadata *entry = &chunk->entries[i];
+			if (entry->ready && entry->dirty)
+				sectors[cnt++] = entry->sector;
+		}
+	}
+	lock_release(&cache_lock);
+
+	qsort(sectors, cnt, sizeof *sectors, sector_compare);
+
+	acquire_cache_lock();
+	for(size_t i = 0; i < cnt; ){
+		struct metadata *run[RUN_SECTORS];
+		size_t run_cnt = 0, run_sectors = 0;
+
+		// the sectors may have been evicted or cleaned while unlocked
+		for(; i < cnt; i++){
+			struct metadata *entry = find(sectors[i]);
+			if(entry == NULL || !entry->ready || !entry->dirty)
+				continue;
+			if(run_cnt > 0
+			   && (entry->sector != run[0]->sector + run_sectors
+				   || run_sectors + unit_cnt(entry->sector) > RUN_SECTORS))
+				break;
+			run[run_cnt++] = entry;
+			run_sectors += unit_cnt(entry->sector);
 		}
+		if(run_cnt > 0)
+			write_run(run, run_cnt);
+	}
+	lock_release(&cache_lock);
+
+	if (sectors != batch)
+		free(sectors);
+}
+
+/*Asks the read-ahead thread to bring SECTOR into the cache in the
+  background. Sectors already cached, or requests past a full queue,
+  are ignored.*/
+void bufcache_prefetch(block_sector_t sector) {
+	sector = unit_start(sector);
+	acquire_cache_lock();
+	if (ra_cnt < RA_QUEUE_SIZE && find(sector) == NULL) {
+		struct ra_request *r = &ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE];
+		r->sector = sector;
+		r->tid = thread_current()->tid;
+		cond_signal(&ra_wanted, &cache_lock);
 	}
 	lock_release(&cache_lock);
 }
+
+/*Loads SECTOR into the cache for read-ahead on behalf of thread TID.
+  Unlike a demand access this never waits for an entry to free up: if
+  everything is busy the request is simply dropped.*/
+static void prefetch(block_sector_t sector, tid_t tid) {
+	ASSERT(lock_held_by_current_thread(&cache_lock));
+	while (find(sector) == NULL) {
+		struct metadata *victim = quota_victim(tid);
+		if (victim == NULL)
+			victim = get_eviction_candidate();
+		if (victim == NULL) {
+			return;
+		} else if (victim->dirty) {
+			clean(victim);
+		} else {
+			replace(victim, sector);
+			set_owner(victim, tid);
+			victim->prefetched = true;
+			return;
+		}
+	}
+}
+
+/*Background read-ahead thread. Serves prefetch requests in the order they
+  were queued, so the caller that is streaming through a file finds its
+  next sectors already cached.*/
+static void read_ahead(void *aux UNUSED) {
+	acquire_cache_lock();
+	for (;;) {
+		while (ra_cnt == 0)
+			cond_wait(&ra_wanted, &cache_lock);
+		struct ra_request r = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+		ra_cnt--;
+		prefetch(r.sector, r.tid);
+	}
+}
+
+/* The hot set as saved in HOT_SET_SECTOR: the units the cache held at
+   shutdown, hottest first. */
+#define HOT_SET_MAGIC 0x54534f48        /* "HOST", little-endian. */
+#define HOT_SET_MAX ((BLOCK_SECTOR_SIZE - 2 * sizeof(uint32_t)) \
+					 / sizeof(block_sector_t))
+struct hot_set {
+	uint32_t magic;
+	uint32_t cnt;
+	block_sector_t sectors[HOT_SET_MAX];
+};
+
+/*Records the units the cache holds in HOT_SET_SECTOR, so the next boot
+  can load them back in with bufcache_prewarm(). Call before the final
+  bufcache_flush().*/
+void bufcache_save_hot(void) {
+	struct hot_set *hot = malloc(sizeof *hot);
+	if (hot == NULL)
+		return;
+
+	acquire_cache_lock();
+	hot->cnt = policy->hottest(hot->sectors, HOT_SET_MAX);
+	lock_release(&cache_lock);
+	hot->magic = HOT_SET_MAGIC;
+	memset(&hot->sectors[hot->cnt], 0,
+		   (HOT_SET_MAX - hot->cnt) * sizeof *hot->sectors);
+	bufcache_write(HOT_SET_SECTOR, hot, 0, BLOCK_SECTOR_SIZE);
+	free(hot);
+}
+
+/*Loads the saved hot set in the background, in ascending sector order*/
+static void prewarm(void *hot_) {
+	struct hot_set *hot = hot_;
+	tid_t tid = thread_current()->tid;
+
+	for (size_t i = 0; i < hot->cnt; i++) {
+		acquire_cache_lock();
+		prefetch(hot->sectors[i], tid);
+		lock_release(&cache_lock);
+	}
+	free(hot);
+}
+
+/*Starts loading the units saved by bufcache_save_hot() at the last
+  shutdown, as many of the hottest as fit in the cache. A missing or
+  damaged hot set is ignored.*/
+void bufcache_prewarm(void) {
+	struct hot_set *hot = malloc(sizeof *hot);
+	size_t cnt = 0;
+
+	if (hot == NULL)
+		return;
+	bufcache_read(HOT_SET_SECTOR, hot, 0, BLOCK_SECTOR_SIZE);
+	if (hot->magic != HOT_SET_MAGIC || hot->cnt > HOT_SET_MAX) {
+		free(hot);
+		return;
+	}
+	for (size_t i = 0; i < hot->cnt && cnt < entry_cnt; i++)
+		if (hot->sectors[i] < block_size(fs_device))
+			hot->sectors[cnt++] = unit_start(hot->sectors[i]);
+	hot->cnt = cnt;
+	qsort(hot->sectors, hot->cnt, sizeof *hot->sectors, sector_compare);
+	if (thread_create("bufcache-warm", PRI_DEFAULT, prewarm, hot, NULL)
+		== TID_ERROR)
+		free(hot);
+}
+
+/*Background write-behind thread. Sleeps until flush_ticker() or the
+  high-water mark wakes it, and writes the dirty entries back so that
+  eviction almost always finds a clean victim.*/
+static void flusher(void *aux UNUSED) {
+	for (;;) {
+		lock_acquire(&cache_lock);
+		while (!flush_due)
+			cond_wait(&flush_wanted, &cache_lock);
+		flush_due = false;
+		lock_release(&cache_lock);
+		bufcache_flush();
+	}
+}
+
+/*Wakes the flusher every bufcache_flush_ticks timer ticks*/
+static void flush_ticker(void *aux UNUSED) {
+	for (;;) {
+		timer_sleep(bufcache_flush_ticks);
+		lock_acquire(&cache_lock);
+		wake_flusher();
+		lock_release(&cache_lock);
+	}
+}
+
 int get_hit_rate(void) {
-	return (num_hit * 100) / num_accesses;
+	acquire_cache_lock();
+	unsigned hits = stats.hits - stats_at_reset.hits;
+	unsigned misses = stats.misses - stats_at_reset.misses;
+	lock_release(&cache_lock);
+	return hits + misses > 0 ? hits * 100 / (hits + misses) : 0;
 }
 
-/*Resets the cache by flushing dirty entries and reseting the number of hits and accesses*/
+/*Resets the cache by flushing dirty entries and restarting the counts
+  behind get_hit_rate() and get_device_writes()*/
 void reset_cache(void) {
 	bufcache_flush();
-	lock_acquire(&cache_lock);
-	num_hit = 0;
-	num_accesses = 0;
-	wrt_count = 0;
+	acquire_cache_lock();
+	stats_at_reset = stats;
+	device_writes_at_reset = block_write_cnt(fs_device);
 	lock_release(&cache_lock);
 }
 
-/*Returns the number of writes that have been made back to disk*/
+/*Copies the cache's counters since boot into *OUT without resetting them*/
+void bufcache_get_stats(struct cache_stats *out) {
+	acquire_cache_lock();
+	*out = stats;
+	out->capacity = entry_cnt * bufcache_unit;
+	lock_release(&cache_lock);
+	out->bytes_written = block_write_cnt(fs_device) * BLOCK_SECTOR_SIZE;
+	lock_acquire(&fill_lock);
+	out->bytes_read += fill_bytes;
+	lock_release(&fill_lock);
+}
+
+/*Prints cache and read-ahead statistics*/
+void bufcache_print_stats(void) {
+	struct cache_stats s;
+
+	bufcache_get_stats(&s);
+	printf("Cache: %u hits, %u misses, %u evictions, %u write-backs, "
+		   "%u blind writes\n", s.hits, s.misses, s.evictions,
+		   s.write_backs, s.blind_writes);
+	printf("Cache: %u ready waits, %u victim waits, %u lock waits, "
+		   "%"PRIu64" bytes read, %"PRIu64" bytes written\n",
+		   s.ready_waits, s.victim_waits, s.lock_waits,
+		   s.bytes_read, s.bytes_written);
+	printf("Read-ahead: %u used, %u wasted\n",
+		   s.readahead_used, s.readahead_wasted);
+}
+
+/*Returns the number of sectors the cache can hold right now*/
+size_t bufcache_capacity(void) {
+	return entry_cnt * bufcache_unit;
+}
+
+/*Gives back up to PAGE_CNT pages that the cache borrowed from the user
+  pool and returns how many it freed. Dirty entries on those pages are
+  written back first; pages with entries in use are kept. palloc calls
+  this when the user pool runs out; it does nothing if the caller is
+  the cache itself.*/
+size_t bufcache_shrink(size_t page_cnt) {
+	size_t freed = 0;
+
+	if (entry_cnt == 0 || lock_held_by_current_thread(&cache_lock))
+		return 0;
+
+	acquire_cache_lock();
+	for (size_t tries = entry_cnt; freed < page_cnt && tries > 0; tries--) {
+		struct chunk *chunk = idle_chunk();
+		struct metadata *dirty = NULL;
+
+		if (chunk == NULL)
+			break;
+		for (size_t i = 0; i < entries_per_page && dirty == NULL; i++)
+			if (chunk->entries[i].dirty)
+				dirty = &chunk->entries[i];
+		if (dirty != NULL) {
+			// the chunk may be in use again by the time this is done
+			clean(dirty);
+		} else {
+			remove_chunk(chunk);
+			freed++;
+		}
+	}
+	lock_release(&cache_lock);
+	return freed;
+}
+
+/*Returns the number of sectors written to the file system device since
+  the last reset_cache(). The block layer counts them, so write-backs,
+  direct transfers and delayed allocation flushes are all included, and
+  a multi-sector command counts once per sector*/
 int get_device_writes(void) {
-	return wrt_count;
+	acquire_cache_lock();
+	int cnt = block_write_cnt(fs_device) - device_writes_at_reset;
+	lock_release(&cache_lock);
+	return cnt;
 }
@@ -1,20 +1,52 @@
 #include <stdbool.h>
+#include <cache-stats.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 #include "threads/synch.h"
 #include <list.h>
 
+/* Write-behind tuning, controlled by kernel command-line options
+   "-cache-flush=TICKS" and "-cache-hiwat=PERCENT". */
+extern int bufcache_flush_ticks;
+extern int bufcache_high_water;
 
+/* Cache size in sectors, controlled by "-cache-size=SECTORS" and
+   "-cache-max=SECTORS". */
+extern int bufcache_size;
+extern int bufcache_max_size;
 
+/* Sectors per cache entry, a power of 2 up to a page, controlled by
+   "-cache-unit=SECTORS". */
+extern int bufcache_unit;
+
+/* Soft per-thread share of the cache in percent, controlled by
+   "-cache-quota=PCT"; 0 means no quotas. */
+extern int bufcache_quota;
+
+bool bufcache_set_policy(const char *name);
 void bufcache_init(void);
 
 void bufcache_read(block_sector_t sector, void *buffer, 
 				   size_t offset, size_t length);
 
-void bufcache_write(block_sector_t sector, void *buffer, 
+void bufcache_write(block_sector_t sector, const void *buffer, 
 				   size_t offset, size_t length);
 
+void bufcache_zero(block_sector_t sector);
+void bufcache_read_direct(block_sector_t sector, size_t cnt, void *buffer);
+void bufcache_write_direct(block_sector_t sector, size_t cnt,
+						   const void *buffer);
+void *bufcache_pin(block_sector_t sector, bool write);
+void bufcache_unpin(block_sector_t sector, bool write);
+
 void bufcache_flush(void);
+void bufcache_prefetch(block_sector_t sector);
+void bufcache_save_hot(void);
+void bufcache_prewarm(void);
+void bufcache_print_stats(void);
+void bufcache_get_stats(struct cache_stats *);
 void reset_cache(void);
 int get_hit_rate(void);
-int get_device_writes(void);
\ No newline at end of file
+int get_device_writes(void);
+size_t bufcache_capacity(void);
+size_t bufcache_shrink(size_t page_cnt);
\ No newline at end of file
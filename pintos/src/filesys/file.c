@@ -113,6 +113,39 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Allocates disk space for SIZE bytes of FILE starting at offset
+   FILE_OFS, growing FILE if the range ends past its end.
+   Returns true if successful, false if the disk is full or
+   writes to FILE are denied.
+   The file's current position is unaffected. */
+bool
+file_allocate (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_allocate (file->inode, file_ofs, size);
+}
+
+/* Sets the size of FILE to SIZE bytes, freeing the disk space past
+   the new end if it shrinks.
+   Returns true if successful, false if the disk is full or
+   writes to FILE are denied.
+   The file's current position is unaffected. */
+bool
+file_truncate (struct file *file, off_t size)
+{
+  return inode_truncate (file->inode, size);
+}
+
+/* Makes SIZE bytes of FILE starting at offset FILE_OFS read as
+   zeros, freeing the disk space they took up.  The file's size and
+   current position are unaffected.
+   Returns true if successful, false if the disk is full or
+   writes to FILE are denied. */
+bool
+file_punch_hole (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_punch_hole (file->inode, file_ofs, size);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -1,6 +1,7 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 
@@ -17,6 +18,9 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+bool file_allocate (struct file *, off_t start, off_t size);
+bool file_truncate (struct file *, off_t size);
+bool file_punch_hole (struct file *, off_t start, off_t size);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
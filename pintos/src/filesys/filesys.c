@@ -32,6 +32,8 @@ filesys_init (bool format)
     do_format ();
 
   free_map_open ();
+  if (!format)
+    bufcache_prewarm ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -39,7 +41,10 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
+  if (!inode_flush_all ())
+    printf ("filesys: some delayed data was lost\n");
   free_map_close ();
+  bufcache_save_hot ();
   bufcache_flush();
 }
 
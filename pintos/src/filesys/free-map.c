@@ -7,6 +7,17 @@
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static size_t free_cnt;              /* Sectors free in FREE_MAP. */
+static size_t reserved_cnt;          /* Free sectors set aside for
+                                        delayed allocations. */
+
+/* Returns the number of free sectors not set aside, plus RESERVED
+   of those that are, which the caller is entitled to. */
+static size_t
+available (size_t reserved)
+{
+  return free_cnt - reserved_cnt + reserved;
+}
 
 /* Initializes the free map. */
 void
@@ -17,37 +28,161 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, HOT_SET_SECTOR);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
   lock_init(&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available, leaving aside those reserved, or if the
+   free_map file could not be written. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (cnt <= available (0))
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
   if (sector != BITMAP_ERROR
       && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+      && !bitmap_write_range (free_map, free_map_file, sector, cnt))
     {
       bitmap_set_multiple (free_map, sector, cnt, false);
       sector = BITMAP_ERROR;
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      free_cnt -= cnt;
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of at most CNT consecutive sectors, preferably
+   starting at GOAL, and stores the first into *SECTORP.  If GOAL
+   is taken, looks for a full run at or after GOAL, then anywhere,
+   then for runs half as long, so that a nearly full disk still
+   yields space.  If RESERVED is nonnull, the run may use up to
+   *RESERVED sectors the caller set aside with free_map_reserve(),
+   and *RESERVED drops by as many as it uses.  Returns the number of
+   sectors allocated, which is 0 if the disk is full or the
+   free_map file could not be written. */
+size_t
+free_map_allocate_run (size_t cnt, block_sector_t goal, size_t *reserved,
+                       block_sector_t *sectorp)
+{
+  size_t sectors = bitmap_size (free_map);
+  block_sector_t sector = BITMAP_ERROR;
+  size_t got = 0;
+
+  ASSERT (cnt > 0);
+  lock_acquire (&free_map_lock);
+  if (cnt > available (reserved != NULL ? *reserved : 0))
+    cnt = available (reserved != NULL ? *reserved : 0);
+  if (cnt == 0)
+    ;
+  else if (goal < sectors && !bitmap_test (free_map, goal))
+    {
+      sector = goal;
+      while (got < cnt && goal + got < sectors
+             && !bitmap_test (free_map, goal + got))
+        got++;
+    }
+  else
+    for (got = cnt; got > 0; got /= 2)
+      {
+        sector = bitmap_scan (free_map, goal < sectors ? goal : 0, got, false);
+        if (sector == BITMAP_ERROR)
+          sector = bitmap_scan (free_map, 0, got, false);
+        if (sector != BITMAP_ERROR)
+          break;
+      }
+
+  if (got > 0)
+    {
+      bitmap_set_multiple (free_map, sector, got, true);
+      if (free_map_file != NULL
+          && !bitmap_write_range (free_map, free_map_file, sector, got))
+        {
+          bitmap_set_multiple (free_map, sector, got, false);
+          got = 0;
+        }
+      else
+        {
+          size_t used = 0;
+          if (reserved != NULL)
+            {
+              used = got < *reserved ? got : *reserved;
+              *reserved -= used;
+            }
+          free_cnt -= got;
+          reserved_cnt -= used;
+          *sectorp = sector;
+        }
+    }
+  lock_release (&free_map_lock);
+  return got;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_cnt += cnt;
+  bitmap_write_range (free_map, free_map_file, sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Makes the CNT sector runs in RUNS available for use, under one
+   acquisition of the free map lock. */
+void
+free_map_release_runs (const struct sector_run *runs, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  for (size_t i = 0; i < cnt; i++)
+    {
+      ASSERT (bitmap_all (free_map, runs[i].start, runs[i].cnt));
+      bitmap_set_multiple (free_map, runs[i].start, runs[i].cnt, false);
+      free_cnt += runs[i].cnt;
+      bitmap_write_range (free_map, free_map_file, runs[i].start,
+                          runs[i].cnt);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Sets aside CNT free sectors for data whose place on disk is
+   chosen later, so that no other allocation can take them.
+   Returns false if fewer than CNT free sectors are left that are
+   not already set aside. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = cnt <= available (0);
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors set aside by free_map_reserve() and not
+   used since. */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -59,6 +194,7 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
@@ -73,14 +209,21 @@ free_map_close (void)
 void
 free_map_create (void)
 {
-  /* Create inode. */
+  struct file *file;
+
+  /* Create inode.  Its sectors are allocated up front, while
+     FREE_MAP_FILE is still null, because writing the free map must
+     never need to allocate. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
+    PANIC ("can't open free map");
+  if (!file_allocate (file, 0, bitmap_file_size (free_map)))
+    PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
-    PANIC ("can't open free map");
+  free_map_file = file;
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
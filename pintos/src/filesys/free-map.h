@@ -7,6 +7,13 @@
 #include "threads/synch.h"
 struct lock free_map_lock;
 
+/* CNT consecutive sectors starting at START. */
+struct sector_run
+  {
+    block_sector_t start;
+    size_t cnt;
+  };
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
@@ -14,6 +21,11 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_run (size_t, block_sector_t goal, size_t *reserved,
+                              block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_runs (const struct sector_run *, size_t cnt);
+bool free_map_reserve (size_t cnt);
+void free_map_unreserve (size_t cnt);
 
 #endif /* filesys/free-map.h */
@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/timer.h"
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -221,3 +223,56 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* fsutil_cache_bench() times cache hits in rounds of BENCH_HITS,
+   for at least BENCH_MIN_TICKS timer ticks per working set size,
+   so that the tick count is large next to its one-tick
+   granularity. */
+#define BENCH_HITS (1 << 16)
+#define BENCH_MIN_TICKS (2 * TIMER_FREQ)
+
+/* Measures buffer cache hit latency as the number of resident
+   entries grows.  For each working set size, the working set is
+   first read into the cache and then read again in rounds of
+   BENCH_HITS until BENCH_MIN_TICKS have passed, so every timed
+   access is a hit.  Reports the hits made and the ticks they
+   took. */
+void
+fsutil_cache_bench (char **argv UNUSED)
+{
+  size_t capacity = bufcache_capacity ();
+  size_t working_set;
+  uint32_t word;
+
+  if (capacity > block_size (fs_device))
+    capacity = block_size (fs_device);
+
+  printf ("Timing cache hits for at least %d ticks per working set "
+          "size...\n", BENCH_MIN_TICKS);
+  for (working_set = 1; working_set <= capacity; working_set *= 2)
+    {
+      int64_t start, ticks;
+      block_sector_t sector;
+      unsigned long long hits = 0;
+      int i;
+
+      for (sector = 0; sector < working_set; sector++)
+        bufcache_read (sector, &word, 0, sizeof word);
+
+      start = timer_ticks ();
+      do
+        {
+          for (i = 0; i < BENCH_HITS; i++)
+            bufcache_read (i % working_set, &word, 0, sizeof word);
+          hits += BENCH_HITS;
+          ticks = timer_elapsed (start);
+        }
+      while (ticks < BENCH_MIN_TICKS);
+      printf ("%6zu entries: %10llu hits in %6"PRId64" ticks\n",
+              working_set, hits, ticks);
+
+      if (working_set < capacity && working_set * 2 > capacity)
+        working_set = capacity / 2;
+    }
+  printf ("Cache benchmark done.\n");
+}
@@ -1,7 +1,9 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
@@ -10,14 +12,77 @@
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
-#define DIRECT_BLOCKS 1
-#define INDIRECT_BLOCKS 128
-#define DB_INDIRECT_BLOCKS 128*128
-
 
+/* Extent map capacities.  An inode maps its data with up to
+   INODE_EXTENTS extents of its own (depth 0).  Once those run out
+   they move to a leaf block and the inode instead indexes up to
+   INODE_INDEX leaf blocks of LEAF_EXTENTS extents each (depth 1).
+   When the index fills up in turn, it moves to an index block of
+   NODE_INDEX entries and the inode indexes those (depth 2), and so
+   on.  DEPTH_MAX levels map more extents than a file can have
+   sectors. */
+#define INODE_EXTENTS 40
+#define INODE_INDEX 60
+#define NODE_INDEX 63
+#define LEAF_EXTENTS 42
+#define DEPTH_MAX 3
+
+/* Bytes of data a file keeps in its inode's extent map space
+   instead of in data sectors, while it is no longer than that. */
+#define INLINE_BYTES 480
+
+/* Read-ahead window bounds, in sectors.  The window starts at
+   RA_MIN_WINDOW on the first sequential read and doubles with
+   every further sequential read, up to RA_MAX_WINDOW. */
+#define RA_MIN_WINDOW 2
+#define RA_MAX_WINDOW 32
+
+/* Leaf extents remembered per open inode, so that repeated lookups
+   in a fragmented file need not visit its leaf blocks. */
+#define XLATE_SLOTS 4
+
+/* Sectors a file growing at its end reserves past the write, as
+   many as it already has but within these bounds. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 64
+
+/* Inodes kept in memory after their last close, for reopening. */
+#define CLOSED_MAX 32
+
+/* Sector runs freed together by one free map update. */
+#define RELEASE_BATCH 16
+
+/* Aligned transfers of at least this many sectors that map to
+   consecutive disk sectors bypass the buffer cache. */
+#define DIRECT_MIN 16
+
+/* Sectors of data written to holes that an inode keeps in memory,
+   with disk space reserved but not yet chosen, before writing them
+   back as one run. */
+#define DELAY_MAX 32
+
+struct inode_disk;
+
+void inode_free(struct inode_disk *disk_inode);
+
+/* LENGTH sectors of file data, starting at sector LOGICAL of the
+   file and at sector START on disk. */
+struct extent
+  {
+    uint32_t logical;
+    block_sector_t start;
+    uint32_t length;
+  };
 
-void inode_free(block_sector_t inode_sector);
-block_sector_t inode_extend(block_sector_t inode_sector, off_t extend_to);
+/* Block CHILD, a leaf or an index block one level down, maps the
+   extents from sector LOGICAL of the file up to where the next
+   index entry's block begins.  The first entry of an index also
+   maps any extents before its LOGICAL. */
+struct extent_idx
+  {
+    uint32_t logical;
+    block_sector_t child;
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
@@ -25,11 +90,46 @@ struct inode_disk
   {
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[122];               /* Not used. */
     uint32_t isdir;
-    block_sector_t direct_ptrs;
-    block_sector_t singly_indirect_ptrs;
-    block_sector_t doubly_indirect_ptrs;
+    uint32_t depth;                     /* 0: EXTENTS in use, else INDEX. */
+    uint32_t cnt;                       /* Entries in use. */
+    uint32_t is_inline;                 /* Nonzero: data is in INLINE_DATA. */
+    uint32_t unused[2];                 /* Not used. */
+    union
+      {
+        struct extent extents[INODE_EXTENTS];   /* Sorted by LOGICAL. */
+        struct extent_idx index[INODE_INDEX];   /* Sorted by LOGICAL. */
+        uint8_t inline_data[INLINE_BYTES];      /* File data, if inline. */
+      };
+  };
+
+/* Extent leaf block of an inode at depth 1 or more.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_leaf
+  {
+    uint32_t cnt;                       /* Extents in use. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[LEAF_EXTENTS];  /* Sorted by LOGICAL. */
+  };
+
+/* Extent index block of an inode at depth 2 or more, between the
+   inode and its leaves.  Must be exactly BLOCK_SECTOR_SIZE bytes
+   long. */
+struct extent_node
+  {
+    uint32_t cnt;                       /* Entries in use. */
+    uint32_t unused;                    /* Not used. */
+    struct extent_idx index[NODE_INDEX];  /* Sorted by LOGICAL. */
+  };
+
+/* The blocks of an extent map passed through on the way down to a
+   leaf.  BLOCK[H] is the block H levels above the leaves, and
+   SLOT[H] is the entry that points to it in BLOCK[H + 1], or in the
+   inode for the top one. */
+struct extent_path
+  {
+    block_sector_t block[DEPTH_MAX];
+    size_t slot[DEPTH_MAX];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -43,284 +143,1041 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem closed_elem;       /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
-    int open_cnt;                       /* Number of openers. */
+    int open_cnt;                       /* Number of openers, 0 if closed. */
     bool removed;                       /* True if deleted, false otherwise. */
-    bool extending;
+    bool loading;                       /* DATA is still being read in. */
+    bool kept;                          /* Closed, but held out of closed_inodes
+                                           with data it could not write back. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    off_t length;
-    struct lock inode_lock;
+    struct lock inode_lock;             /* Guards the fields above, RA_* and XLATE. */
+    struct rw_lock map_lock;            /* Shared to transfer data, exclusive
+                                           to change DATA. */
+    off_t ra_next;                      /* Offset a sequential read would start at. */
+    off_t ra_end;                       /* End of the range already read ahead. */
+    int ra_window;                      /* Read-ahead window in sectors, 0 if random. */
+    struct inode_disk data;             /* Copy of the on-disk inode. */
+    struct extent xlate[XLATE_SLOTS];   /* Leaf extents used lately, or empty. */
+    int xlate_next;                     /* Slot XLATE fills next. */
+    block_sector_t prealloc_start;      /* Free-map sectors reserved for growth, */
+    size_t prealloc_cnt;                /* how many of them, */
+    uint32_t prealloc_logical;          /* and the file sector they map to. */
+    uint8_t *delay_data;                /* Data of sectors not yet allocated, */
+    uint32_t delay_start;               /* the file sector it starts at, */
+    size_t delay_cnt;                   /* and how many sectors it holds. */
+    size_t delay_reserved;              /* Sectors reserved for DELAY_DATA, */
+    size_t delay_map_reserved;          /* and for extent map blocks. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns 0 if INODE does not contain data for a byte at offset
-   POS. */
+/* Returns the index of the first of the CNT extents in EXT that
+   ends past file sector L, or CNT if there is none. */
+static size_t
+extent_search (const struct extent *ext, size_t cnt, uint32_t l)
+{
+  size_t lo = 0, hi = cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (ext[mid].logical + ext[mid].length <= l)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Adds extent NEW, which must cover only a hole, to the *CNT
+   extents in EXT, which has room for CAP.  NEW is merged into a
+   neighbour that it continues both in the file and on disk.
+   Returns false if it needs a slot and there is none. */
+static bool
+extent_insert (struct extent *ext, uint32_t *cnt, size_t cap,
+               struct extent new)
+{
+  size_t i = extent_search (ext, *cnt, new.logical);
+  bool left, right;
+
+  ASSERT (i == *cnt || ext[i].logical >= new.logical + new.length);
+  left = (i > 0
+          && ext[i - 1].logical + ext[i - 1].length == new.logical
+          && ext[i - 1].start + ext[i - 1].length == new.start);
+  right = (i < *cnt
+           && new.logical + new.length == ext[i].logical
+           && new.start + new.length == ext[i].start);
+
+  if (left && right)
+    {
+      ext[i - 1].length += new.length + ext[i].length;
+      memmove (&ext[i], &ext[i + 1], (*cnt - i - 1) * sizeof *ext);
+      (*cnt)--;
+    }
+  else if (left)
+    ext[i - 1].length += new.length;
+  else if (right)
+    {
+      ext[i].logical = new.logical;
+      ext[i].start = new.start;
+      ext[i].length += new.length;
+    }
+  else
+    {
+      if (*cnt == cap)
+        return false;
+      memmove (&ext[i + 1], &ext[i], (*cnt - i) * sizeof *ext);
+      ext[i] = new;
+      (*cnt)++;
+    }
+  return true;
+}
+
+/* Returns the index of the entry among the CNT in INDEX whose block
+   covers file sector L. */
+static size_t
+index_search (const struct extent_idx *index, size_t cnt, uint32_t l)
+{
+  size_t i = 0;
+
+  while (i + 1 < cnt && index[i + 1].logical <= l)
+    i++;
+  return i;
+}
+
+/* Inserts ENTRY among the *CNT entries in INDEX, right after entry
+   I, which must leave room for it. */
+static void
+index_insert (struct extent_idx *index, uint32_t *cnt, size_t i,
+              struct extent_idx entry)
+{
+  memmove (&index[i + 2], &index[i + 1], (*cnt - i - 1) * sizeof *index);
+  index[i + 1] = entry;
+  (*cnt)++;
+}
+
+/* Finds the leaf of DISK, which must be at depth 1 or more, that
+   covers file sector L, and records the way down to it in *PATH.
+   Returns the leaf's sector. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+extent_descend (const struct inode_disk *disk, uint32_t l,
+                struct extent_path *path)
 {
-  ASSERT (inode != NULL);
-  block_sector_t sector = 0;
-  size_t index = pos / BLOCK_SECTOR_SIZE;
-  if(index < DIRECT_BLOCKS){
-    bufcache_read(inode->sector, &sector,offsetof(struct inode_disk, direct_ptrs),
-     sizeof(block_sector_t));
-  }
-  else if (index < DIRECT_BLOCKS + INDIRECT_BLOCKS)
-  {
-    bufcache_read(inode->sector, &sector, offsetof(struct inode_disk, singly_indirect_ptrs),
-     sizeof(block_sector_t));
+  size_t h = disk->depth - 1;
 
-    bufcache_read(sector, &sector, (index - DIRECT_BLOCKS) * sizeof(block_sector_t),
-     sizeof(block_sector_t));
-  }
-  else if (index < DIRECT_BLOCKS + INDIRECT_BLOCKS + DB_INDIRECT_BLOCKS){
-    // level 2 read
-    bufcache_read(inode->sector, &sector, offsetof(struct inode_disk, doubly_indirect_ptrs),
-     sizeof(block_sector_t));
-    // level 1 read
-    int double_index = (index - DIRECT_BLOCKS - INDIRECT_BLOCKS) / INDIRECT_BLOCKS;
-    bufcache_read(sector, &sector, double_index *sizeof(block_sector_t),
-     sizeof(block_sector_t));
-    // level 0 read
-    int single_index = (index - DIRECT_BLOCKS - INDIRECT_BLOCKS) % INDIRECT_BLOCKS;
-    bufcache_read(sector, &sector, single_index * sizeof(block_sector_t),
-     sizeof(block_sector_t));
+  path->slot[h] = index_search (disk->index, disk->cnt, l);
+  path->block[h] = disk->index[path->slot[h]].child;
+  while (h-- > 0)
+    {
+      const struct extent_node *node = bufcache_pin (path->block[h + 1],
+                                                     false);
+      path->slot[h] = index_search (node->index, node->cnt, l);
+      path->block[h] = node->index[path->slot[h]].child;
+      bufcache_unpin (path->block[h + 1], false);
+    }
+  return path->block[0];
+}
 
-  }
+/* Returns the disk sector that holds sector L of the file whose
+   on-disk inode is DISK, without allocating anything, and stores
+   the extent that maps it in *FOUND.  Returns 0 if L lies in a
+   hole. */
+static block_sector_t
+extent_lookup (const struct inode_disk *disk, uint32_t l,
+               struct extent *found)
+{
+  const struct extent *ext = disk->extents;
+  size_t cnt = disk->cnt, i;
+  const struct extent_leaf *leaf = NULL;
+  block_sector_t leaf_sector = 0, sector = 0;
+
+  if (disk->depth > 0)
+    {
+      struct extent_path path;
+
+      leaf_sector = extent_descend (disk, l, &path);
+      leaf = bufcache_pin (leaf_sector, false);
+      ext = leaf->extents;
+      cnt = leaf->cnt;
+    }
+  i = extent_search (ext, cnt, l);
+  if (i < cnt && ext[i].logical <= l)
+    {
+      *found = ext[i];
+      sector = ext[i].start + (l - ext[i].logical);
+    }
+  if (leaf != NULL)
+    bufcache_unpin (leaf_sector, false);
   return sector;
 }
 
+/* Moves the extents of depth-0 inode DISK out to a new leaf block
+   that the inode then indexes, allocated as free_map_allocate_run()
+   does with RESERVED.  Returns false if the disk is full. */
+static bool
+deepen (struct inode_disk *disk, size_t *reserved)
+{
+  block_sector_t leaf_sector;
+  struct extent_leaf *leaf;
+
+  ASSERT (disk->depth == 0);
+  if (free_map_allocate_run (1, 0, reserved, &leaf_sector) == 0)
+    return false;
+  bufcache_zero (leaf_sector);
+  leaf = bufcache_pin (leaf_sector, true);
+  leaf->cnt = disk->cnt;
+  memcpy (leaf->extents, disk->extents, disk->cnt * sizeof *disk->extents);
+  bufcache_unpin (leaf_sector, true);
+
+  disk->depth = 1;
+  disk->cnt = 1;
+  disk->index[0].logical = 0;
+  disk->index[0].child = leaf_sector;
+  return true;
+}
 
-/*extends the inode*/
-block_sector_t inode_extend(block_sector_t inode_sector, off_t extend_to){
+/* Splits full leaf LEAF_SECTOR in two to add extent NEW, moving the
+   upper half of its extents to new leaf RIGHT_SECTOR.  Returns the
+   index entry for the new leaf. */
+static struct extent_idx
+leaf_split (block_sector_t leaf_sector, block_sector_t right_sector,
+            struct extent new)
+{
+  struct extent_leaf *leaf = bufcache_pin (leaf_sector, true);
+  struct extent_leaf *right;
+  struct extent_idx entry;
+  size_t half = leaf->cnt / 2;
+
+  bufcache_zero (right_sector);
+  right = bufcache_pin (right_sector, true);
+  right->cnt = leaf->cnt - half;
+  memcpy (right->extents, &leaf->extents[half],
+          right->cnt * sizeof *right->extents);
+  leaf->cnt = half;
+  if (new.logical >= right->extents[0].logical)
+    extent_insert (right->extents, &right->cnt, LEAF_EXTENTS, new);
+  else
+    extent_insert (leaf->extents, &leaf->cnt, LEAF_EXTENTS, new);
+  entry.logical = right->extents[0].logical;
+  entry.child = right_sector;
+  bufcache_unpin (right_sector, true);
+  bufcache_unpin (leaf_sector, true);
+  return entry;
+}
 
-  size_t index = extend_to / BLOCK_SECTOR_SIZE;
-  block_sector_t sector , indirect_sector, db_indirect_sector;
-  char zeros[BLOCK_SECTOR_SIZE];
-  memset(zeros,0,BLOCK_SECTOR_SIZE);
+/* Adds ENTRY to index block NODE_SECTOR right after entry I,
+   splitting the block in two if it is full, with the upper half of
+   its entries moving to new block RIGHT_SECTOR.  Returns true and
+   stores the index entry for the new block in *UP if it split. */
+static bool
+node_add (block_sector_t node_sector, size_t i, struct extent_idx entry,
+          block_sector_t right_sector, struct extent_idx *up)
+{
+  struct extent_node *node = bufcache_pin (node_sector, true);
+  struct extent_node *right;
+  size_t half = NODE_INDEX / 2;
 
-  if(index < DIRECT_BLOCKS){
-    off_t direct_offset = offsetof(struct inode_disk, direct_ptrs);
-    bufcache_read(inode_sector,&sector, direct_offset, sizeof(block_sector_t));
-    if(!sector){
-      if(free_map_allocate(1,&sector)){
-        bufcache_write(sector,zeros,0,BLOCK_SECTOR_SIZE);
-        bufcache_write(inode_sector,&sector,direct_offset, sizeof(block_sector_t) );
-      }
-      else{
-        return 0;
-      }
+  if (node->cnt < NODE_INDEX)
+    {
+      index_insert (node->index, &node->cnt, i, entry);
+      bufcache_unpin (node_sector, true);
+      return false;
     }
-    return sector;
-  }
-  else if (index < INDIRECT_BLOCKS + DIRECT_BLOCKS){
-
-    bufcache_read(inode_sector,&indirect_sector,
-      offsetof(struct inode_disk, singly_indirect_ptrs),
-      sizeof(block_sector_t));
-    // if indirect blocks haven't been allocated yet.
-    if(!indirect_sector){
-      if(free_map_allocate(1,&indirect_sector)){
-        bufcache_write(indirect_sector,zeros,0,BLOCK_SECTOR_SIZE);
-
-        bufcache_write(inode_sector,&indirect_sector,
-          offsetof(struct inode_disk, singly_indirect_ptrs), sizeof(block_sector_t) );
-      }
-      else{
-        return 0;
+
+  bufcache_zero (right_sector);
+  right = bufcache_pin (right_sector, true);
+  right->cnt = node->cnt - half;
+  memcpy (right->index, &node->index[half], right->cnt * sizeof *right->index);
+  node->cnt = half;
+  if (i < half)
+    index_insert (node->index, &node->cnt, i, entry);
+  else
+    index_insert (right->index, &right->cnt, i - half, entry);
+  up->logical = right->index[0].logical;
+  up->child = right_sector;
+  bufcache_unpin (right_sector, true);
+  bufcache_unpin (node_sector, true);
+  return true;
+}
+
+/* Adds extent NEW to the leaf of DISK, which must be at depth 1 or
+   more, that covers it.  A full leaf splits in two, adding an entry
+   to the index block above it, which may split in turn, and so on
+   up to the inode.  If the inode's index is full too, it moves to a
+   new index block and the tree grows a level.  The blocks this
+   takes are allocated first, as free_map_allocate_run() does with
+   RESERVED, so that this returns false with the map unchanged if
+   the disk is full or the tree may grow no deeper. */
+static bool
+tree_add (struct inode_disk *disk, struct extent new, size_t *reserved)
+{
+  struct extent_path path;
+  block_sector_t spare[DEPTH_MAX + 1];
+  struct extent_leaf *leaf;
+  struct extent_idx up;
+  size_t need, h;
+  bool added;
+
+  extent_descend (disk, new.logical, &path);
+  leaf = bufcache_pin (path.block[0], true);
+  added = extent_insert (leaf->extents, &leaf->cnt, LEAF_EXTENTS, new);
+  bufcache_unpin (path.block[0], true);
+  if (added)
+    return true;
+
+  /* A block for the new leaf, one for each full index block above
+     it, and one to move the inode's index to if that is full. */
+  for (need = 1; need < disk->depth; need++)
+    {
+      const struct extent_node *node = bufcache_pin (path.block[need], false);
+      bool full = node->cnt == NODE_INDEX;
+      bufcache_unpin (path.block[need], false);
+      if (!full)
+        break;
+    }
+  if (need == disk->depth && disk->cnt == INODE_INDEX)
+    {
+      if (disk->depth == DEPTH_MAX)
+        return false;
+      need++;
+    }
+  for (h = 0; h < need; h++)
+    if (free_map_allocate_run (1, 0, reserved, &spare[h]) == 0)
+      {
+        while (h-- > 0)
+          free_map_release (spare[h], 1);
+        return false;
       }
+
+  up = leaf_split (path.block[0], spare[0], new);
+  for (h = 1; h < disk->depth; h++)
+    if (!node_add (path.block[h], path.slot[h - 1], up, spare[h], &up))
+      return true;
+
+  if (disk->cnt < INODE_INDEX)
+    index_insert (disk->index, &disk->cnt, path.slot[h - 1], up);
+  else
+    {
+      /* Grow a level: the inode's index moves to a new block, which
+         has room for the new entry too. */
+      struct extent_node *node;
+
+      bufcache_zero (spare[h]);
+      node = bufcache_pin (spare[h], true);
+      node->cnt = disk->cnt;
+      memcpy (node->index, disk->index, disk->cnt * sizeof *disk->index);
+      index_insert (node->index, &node->cnt, path.slot[h - 1], up);
+      bufcache_unpin (spare[h], true);
+
+      disk->depth++;
+      disk->cnt = 1;
+      disk->index[0].logical = 0;
+      disk->index[0].child = spare[h];
     }
-    // get the index in the second level
-    index -= DIRECT_BLOCKS;
-    // read second level.
-    bufcache_read(indirect_sector, &sector, index*sizeof(block_sector_t),sizeof(block_sector_t));
-    /* if not allocated yet set it to zero and write it back
-     to the required index in doubly indirect poiters. */
-    if(!sector){
-      if(free_map_allocate(1,&sector)){
-        bufcache_write(sector,zeros,0,BLOCK_SECTOR_SIZE);
-        bufcache_write(indirect_sector, &sector, index * sizeof(block_sector_t),
-         sizeof(block_sector_t));
+  return true;
+}
 
-      }
-      else{
-        return 0;
-      }
+/* Maps extent NEW, which must cover only a hole, into the file
+   whose on-disk inode is DISK.  Blocks the extent map needs for it
+   are allocated drawing on *RESERVED as free_map_allocate_run()
+   does, if RESERVED is nonnull.  Returns false, with the map
+   unchanged, if the extent map is full or the disk is. */
+static bool
+extent_add (struct inode_disk *disk, struct extent new, size_t *reserved)
+{
+  if (disk->depth == 0)
+    return (extent_insert (disk->extents, &disk->cnt, INODE_EXTENTS, new)
+            || (deepen (disk, reserved) && tree_add (disk, new, reserved)));
+  return tree_add (disk, new, reserved);
+}
+
+/* Returns how many more extents DISK's extent map can take for
+   certain.  Each one adds at most one entry to the inode's index,
+   splitting full blocks on the way up; when the index is full, it
+   moves to a new block with room to spare and the tree grows a
+   level, until it is DEPTH_MAX deep.  A full inode at depth 0 moves
+   its extents to a leaf the same way. */
+static size_t
+extent_room (const struct inode_disk *disk)
+{
+  if (disk->depth == 0)
+    return INODE_EXTENTS - disk->cnt + DEPTH_MAX * (INODE_INDEX - 1);
+  return (INODE_INDEX - disk->cnt
+          + (DEPTH_MAX - disk->depth) * (INODE_INDEX - 1));
+}
+
+/* Disk sectors on their way back to the free map. */
+struct release_batch
+  {
+    size_t cnt;                             /* Runs in use. */
+    struct sector_run runs[RELEASE_BATCH];
+  };
+
+/* Gives the sectors in BATCH back to the free map and empties it. */
+static void
+batch_flush (struct release_batch *batch)
+{
+  if (batch->cnt > 0)
+    free_map_release_runs (batch->runs, batch->cnt);
+  batch->cnt = 0;
+}
+
+/* Adds the CNT sectors from START on to BATCH, first flushing it if
+   it is full. */
+static void
+batch_add (struct release_batch *batch, block_sector_t start, size_t cnt)
+{
+  if (batch->cnt > 0)
+    {
+      struct sector_run *last = &batch->runs[batch->cnt - 1];
+      if (last->start + last->cnt == start)
+        {
+          last->cnt += cnt;
+          return;
+        }
     }
-    return sector;
+  if (batch->cnt == RELEASE_BATCH)
+    batch_flush (batch);
+  batch->runs[batch->cnt].start = start;
+  batch->runs[batch->cnt].cnt = cnt;
+  batch->cnt++;
+}
 
-  }
-  else if (index < DB_INDIRECT_BLOCKS + INDIRECT_BLOCKS + DIRECT_BLOCKS){
-    bufcache_read(inode_sector,&db_indirect_sector,
-      offsetof(struct inode_disk, doubly_indirect_ptrs),
-      sizeof(block_sector_t));
-    // if doubly indirect pointers haven't been allocated yet.
-    if(!db_indirect_sector){
-      if(free_map_allocate(1,&db_indirect_sector)){
-        bufcache_write(db_indirect_sector,zeros,0,BLOCK_SECTOR_SIZE);
-        bufcache_write(inode_sector,&db_indirect_sector,
-         offsetof(struct inode_disk, doubly_indirect_ptrs),
-          sizeof(block_sector_t));
-
-      } else {
-        return 0;
-      }
+/* Unmaps file sectors [A, B) from the *CNT extents in EXT, adding
+   the disk sectors they held to BATCH.  No extent may reach past
+   both ends; extent_split() handles that case. */
+static void
+extent_cut (struct extent *ext, uint32_t *cnt, uint32_t a, uint32_t b,
+            struct release_batch *batch)
+{
+  size_t i = extent_search (ext, *cnt, a), j;
+
+  if (i < *cnt && ext[i].logical < a)
+    {
+      /* Keep the head of an extent that begins before A. */
+      struct extent *e = &ext[i];
+      uint32_t end = e->logical + e->length;
+
+      ASSERT (end <= b);
+      batch_add (batch, e->start + (a - e->logical), end - a);
+      e->length = a - e->logical;
+      i++;
+    }
+  for (j = i; j < *cnt && ext[j].logical < b; j++)
+    {
+      struct extent *e = &ext[j];
+      uint32_t end = e->logical + e->length;
+
+      if (end <= b)
+        batch_add (batch, e->start, e->length);
+      else
+        {
+          /* Keep the tail of an extent that ends past B. */
+          batch_add (batch, e->start, b - e->logical);
+          e->start += b - e->logical;
+          e->length = end - b;
+          e->logical = b;
+          break;
+        }
+    }
+  memmove (&ext[i], &ext[j], (*cnt - j) * sizeof *ext);
+  *cnt -= j - i;
+}
+
+/* Sets the length of the extent of DISK that starts at file sector
+   LOGICAL to LENGTH. */
+static void
+extent_resize (struct inode_disk *disk, uint32_t logical, uint32_t length)
+{
+  struct extent *ext = disk->extents;
+  size_t cnt = disk->cnt, i;
+  struct extent_leaf *leaf = NULL;
+  block_sector_t leaf_sector = 0;
+
+  if (disk->depth > 0)
+    {
+      struct extent_path path;
+
+      leaf_sector = extent_descend (disk, logical, &path);
+      leaf = bufcache_pin (leaf_sector, true);
+      ext = leaf->extents;
+      cnt = leaf->cnt;
     }
-    // now that we have second level allocated.
-    index -= DIRECT_BLOCKS + INDIRECT_BLOCKS;
-    // each db_indirect_ptr has INDIRECT_BLOCks in side so to find index /INDIRECT_BLOCks
-    bufcache_read(db_indirect_sector, &indirect_sector,
-     (index/INDIRECT_BLOCKS)* sizeof(block_sector_t),
-      sizeof(block_sector_t));
-    // if the found indirect_sector is not allocated
-    if(!indirect_sector){
-      if (free_map_allocate(1,&indirect_sector)){
-        bufcache_write(indirect_sector,zeros,0,BLOCK_SECTOR_SIZE);
-        bufcache_write(db_indirect_sector, &indirect_sector,
-         (index/INDIRECT_BLOCKS)* sizeof(block_sector_t),
-          sizeof(block_sector_t));
-
-      } else {
+  i = extent_search (ext, cnt, logical);
+  ASSERT (i < cnt && ext[i].logical == logical);
+  ext[i].length = length;
+  if (leaf != NULL)
+    bufcache_unpin (leaf_sector, true);
+}
+
+/* Unmaps file sectors [A, B) of DISK from the middle of extent EXT,
+   which reaches past both ends, adding the disk sectors they held
+   to BATCH.  The part from B on becomes an extent of its own, which
+   may take new extent map blocks.  Returns false, with the map
+   unchanged, if there is no room for it. */
+static bool
+extent_split (struct inode_disk *disk, struct extent ext, uint32_t a,
+              uint32_t b, struct release_batch *batch)
+{
+  struct extent tail;
+  bool success;
+
+  tail.logical = b;
+  tail.start = ext.start + (b - ext.logical);
+  tail.length = ext.logical + ext.length - b;
+  extent_resize (disk, ext.logical, a - ext.logical);
+  success = extent_add (disk, tail, NULL);
+  if (success)
+    batch_add (batch, ext.start + (a - ext.logical), b - a);
+  else
+    extent_resize (disk, ext.logical, ext.length);
+  return success;
+}
+
+static void index_unmap (struct extent_idx *, uint32_t *cnt, size_t height,
+                         uint32_t a, uint32_t b, struct release_batch *);
+
+/* Unmaps file sectors [A, B) below extent map block SECTOR, which
+   is HEIGHT levels above the leaves, adding the disk sectors they
+   held, and the blocks below SECTOR left empty, to BATCH.  Returns
+   true if SECTOR is left empty too. */
+static bool
+block_unmap (block_sector_t sector, size_t height, uint32_t a, uint32_t b,
+             struct release_batch *batch)
+{
+  bool empty;
+
+  if (height == 0)
+    {
+      struct extent_leaf *leaf = bufcache_pin (sector, true);
+      extent_cut (leaf->extents, &leaf->cnt, a, b, batch);
+      empty = leaf->cnt == 0;
+      bufcache_unpin (sector, true);
+    }
+  else
+    {
+      struct extent_node *node = bufcache_pin (sector, true);
+      index_unmap (node->index, &node->cnt, height, a, b, batch);
+      empty = node->cnt == 0;
+      bufcache_unpin (sector, true);
+    }
+  return empty;
+}
+
+/* Unmaps file sectors [A, B) below the *CNT entries in INDEX, which
+   is HEIGHT levels above the leaves, as block_unmap() does, and
+   drops the entries of blocks left empty. */
+static void
+index_unmap (struct extent_idx *index, uint32_t *cnt, size_t height,
+             uint32_t a, uint32_t b, struct release_batch *batch)
+{
+  size_t i = index_search (index, *cnt, a);
+
+  while (i < *cnt && (i == 0 || index[i].logical < b))
+    {
+      block_sector_t child = index[i].child;
+
+      if (!block_unmap (child, height - 1, a, b, batch))
+        {
+          i++;
+          continue;
+        }
+      batch_add (batch, child, 1);
+      memmove (&index[i], &index[i + 1], (*cnt - i - 1) * sizeof *index);
+      (*cnt)--;
+    }
+}
+
+/* Unmaps file sectors [A, B) of the file whose on-disk inode is
+   DISK, adding the disk sectors they held, and any extent map
+   block left empty, to BATCH.  Returns false, with the map
+   unchanged, if the hole lies in the middle of an extent and the
+   extent map or the disk has no room for the part after it. */
+static bool
+disk_unmap (struct inode_disk *disk, uint32_t a, uint32_t b,
+            struct release_batch *batch)
+{
+  struct extent ext;
+
+  if (a >= b)
+    return true;
+  if (extent_lookup (disk, a, &ext) != 0 && ext.logical < a
+      && ext.logical + ext.length > b)
+    return extent_split (disk, ext, a, b, batch);
+
+  if (disk->depth == 0)
+    extent_cut (disk->extents, &disk->cnt, a, b, batch);
+  else
+    {
+      index_unmap (disk->index, &disk->cnt, disk->depth, a, b, batch);
+      if (disk->cnt == 0)
+        disk->depth = 0;
+    }
+  return true;
+}
+
+/* Writes INODE's copy of its on-disk inode through to the cache. */
+static void
+inode_sync (struct inode *inode)
+{
+  bufcache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Forgets the leaf extents INODE has remembered, after its extent
+   map changes. */
+static void
+xlate_clear (struct inode *inode)
+{
+  for (int i = 0; i < XLATE_SLOTS; i++)
+    inode->xlate[i].length = 0;
+}
+
+/* Returns the disk sector that holds file sector L of INODE, or 0
+   if L lies in a hole, and stores in *RUN how many sectors from L
+   on map to consecutive disk sectors, at least 1.  Depth-0 inodes
+   are looked up in the in-memory copy; extents found in leaves are
+   remembered.  The caller must hold INODE's map_lock, shared or
+   exclusive. */
+static block_sector_t
+lookup_run (struct inode *inode, uint32_t l, size_t *run)
+{
+  struct extent found;
+  block_sector_t sector;
+
+  *run = 1;
+  if (inode->data.depth == 0)
+    {
+      const struct extent *ext = inode->data.extents;
+      size_t i = extent_search (ext, inode->data.cnt, l);
+
+      if (i == inode->data.cnt || ext[i].logical > l)
         return 0;
-      }
+      *run = ext[i].logical + ext[i].length - l;
+      return ext[i].start + (l - ext[i].logical);
     }
-    // read the the sector you should read data to.
-    bufcache_read(indirect_sector, &sector,
-     (index % INDIRECT_BLOCKS) * sizeof(block_sector_t),
-     sizeof(block_sector_t));
-    /* if the db/ind/dir pointer is not allocated -->
-     the correct sector you should read/write data to. */
-    if(!sector){
-      if(free_map_allocate(1,&sector)){
-        bufcache_write(sector,zeros,0,BLOCK_SECTOR_SIZE);
-        
-        bufcache_write(indirect_sector, &sector,
-         (index % INDIRECT_BLOCKS) * sizeof(block_sector_t),
-         sizeof(block_sector_t));
 
-      }
-      else {
+  /* Several readers may look up at once, so XLATE needs
+     inode_lock of its own. */
+  lock_acquire (&inode->inode_lock);
+  for (int i = 0; i < XLATE_SLOTS; i++)
+    {
+      const struct extent *e = &inode->xlate[i];
+      if (l >= e->logical && l - e->logical < e->length)
+        {
+          sector = e->start + (l - e->logical);
+          *run = e->logical + e->length - l;
+          lock_release (&inode->inode_lock);
+          return sector;
+        }
+    }
+  lock_release (&inode->inode_lock);
+
+  sector = extent_lookup (&inode->data, l, &found);
+  if (sector != 0)
+    {
+      *run = found.logical + found.length - l;
+      lock_acquire (&inode->inode_lock);
+      inode->xlate[inode->xlate_next] = found;
+      inode->xlate_next = (inode->xlate_next + 1) % XLATE_SLOTS;
+      lock_release (&inode->inode_lock);
+    }
+  return sector;
+}
+
+/* Returns the disk sector that holds file sector L of INODE, or 0
+   if L lies in a hole. */
+static block_sector_t
+lookup (struct inode *inode, uint32_t l)
+{
+  size_t run;
+  return lookup_run (inode, l, &run);
+}
+
+/* Returns the block device sector that contains byte offset POS
+   within INODE, without allocating anything.
+   Returns 0 if INODE does not contain data for a byte at offset
+   POS. */
+static block_sector_t
+byte_to_sector (struct inode *inode, off_t pos)
+{
+  ASSERT (inode != NULL);
+  return lookup (inode, pos / BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the first of the disk sectors to transfer directly if a
+   transfer of SIZE more bytes of INODE at OFFSET starts on a sector
+   boundary and its next DIRECT_MIN or more whole sectors lie in one
+   extent, storing how many sectors that is in *CNT.  Returns 0 if
+   the transfer should go through the cache. */
+static block_sector_t
+direct_run (struct inode *inode, off_t offset, off_t size, size_t *cnt)
+{
+  block_sector_t sector;
+  size_t run;
+
+  if (offset % BLOCK_SECTOR_SIZE != 0
+      || size < DIRECT_MIN * BLOCK_SECTOR_SIZE)
+    return 0;
+  sector = lookup_run (inode, offset / BLOCK_SECTOR_SIZE, &run);
+  *cnt = size / BLOCK_SECTOR_SIZE;
+  if (run < *cnt)
+    *cnt = run;
+  return *cnt >= DIRECT_MIN ? sector : 0;
+}
+
+/* Returns the sectors INODE reserved for growth to the free map. */
+static void
+prealloc_release (struct inode *inode)
+{
+  if (inode->prealloc_cnt > 0)
+    free_map_release (inode->prealloc_start, inode->prealloc_cnt);
+  inode->prealloc_cnt = 0;
+}
+
+/* Maps file sectors of INODE starting at L, up to CNT of them, all
+   of which must be holes, to zeroed sectors.  Sectors that lie
+   wholly within bytes [KEEP_POS, KEEP_END) of the file are not
+   zeroed, because the caller is about to overwrite them.  Sectors
+   come from the run reserved by the previous call if it left off
+   at L, and are otherwise allocated right after the sector holding
+   L - 1 when possible, drawing first on the space INODE reserved
+   for delayed data and for the leaves that map it.  If GROW, the run is reserved longer than
+   CNT so that the next append continues it.  Returns the number of
+   sectors mapped, which is 0 if the disk or the extent map is
+   full. */
+static size_t
+map_run (struct inode *inode, uint32_t l, size_t cnt, bool grow,
+         off_t keep_pos, off_t keep_end)
+{
+  struct extent new;
+
+  if (inode->prealloc_cnt == 0 || inode->prealloc_logical != l)
+    {
+      block_sector_t goal = inode->sector + 1;
+      block_sector_t prev = l > 0 ? lookup (inode, l - 1) : 0;
+      size_t extra = 0;
+
+      prealloc_release (inode);
+      if (prev != 0)
+        goal = prev + 1;
+      if (grow)
+        {
+          extra = l + cnt;
+          if (extra < PREALLOC_MIN)
+            extra = PREALLOC_MIN;
+          else if (extra > PREALLOC_MAX)
+            extra = PREALLOC_MAX;
+        }
+      inode->prealloc_cnt = free_map_allocate_run (cnt + extra, goal,
+                                                   &inode->delay_reserved,
+                                                   &inode->prealloc_start);
+      inode->prealloc_logical = l;
+      if (inode->prealloc_cnt == 0)
         return 0;
-      }
     }
-    return sector;
-    // end of two level allocation.
-  }
-  // if it is larger than maximum size return 0;
-  else {
+
+  new.logical = l;
+  new.start = inode->prealloc_start;
+  new.length = cnt < inode->prealloc_cnt ? cnt : inode->prealloc_cnt;
+  if (!extent_add (&inode->data, new, &inode->delay_map_reserved))
     return 0;
-  }
+  for (size_t i = 0; i < new.length; i++)
+    {
+      off_t ofs = (off_t) (l + i) * BLOCK_SECTOR_SIZE;
+      if (ofs < keep_pos || ofs + BLOCK_SECTOR_SIZE > keep_end)
+        bufcache_zero (new.start + i);
+    }
+  inode->prealloc_start += new.length;
+  inode->prealloc_cnt -= new.length;
+  inode->prealloc_logical += new.length;
+  return new.length;
+}
+
+/* Maps every hole of INODE that overlaps bytes [POS, END) to
+   zeroed sectors, each run of holes as few extents as possible.
+   Returns false if the disk or the extent map fills up first.  The
+   caller must hold INODE's map_lock exclusively, and none of
+   [POS, END) may be held back as delayed data. */
+static bool
+fill_holes (struct inode *inode, off_t pos, off_t end)
+{
+  uint32_t l = pos / BLOCK_SECTOR_SIZE;
+  uint32_t last = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  bool success = true;
+
+  while (l < last)
+    {
+      size_t cnt = 0, got;
 
+      while (l + cnt < last && lookup (inode, l + cnt) == 0)
+        cnt++;
+      if (cnt == 0)
+        {
+          l++;
+          continue;
+        }
+      got = map_run (inode, l, cnt,
+                     l + cnt == last && end >= inode->data.length, 0, 0);
+      xlate_clear (inode);
+      if (got == 0)
+        {
+          success = false;
+          break;
+        }
+      l += got;
+    }
+  inode_sync (inode);
+  return success;
+}
 
+/* Moves INODE's inline data out to a data sector, so that the
+   file can grow past INLINE_BYTES.  Returns false if the disk is
+   full.  The caller must hold INODE's map_lock exclusively. */
+static bool
+uninline (struct inode *inode)
+{
+  struct extent new = { 0, 0, 1 };
 
-// end of the function
+  ASSERT (inode->data.is_inline);
+  if (inode->data.length > 0)
+    {
+      if (free_map_allocate_run (1, inode->sector + 1, NULL,
+                                 &new.start) == 0)
+        return false;
+      bufcache_zero (new.start);
+      bufcache_write (new.start, inode->data.inline_data, 0,
+                      inode->data.length);
+    }
+  memset (inode->data.inline_data, 0, INLINE_BYTES);
+  inode->data.is_inline = 0;
+  if (inode->data.length > 0)
+    extent_add (&inode->data, new, NULL);
+  xlate_clear (inode);
+  inode_sync (inode);
+  return true;
 }
 
-/*
-  ** given a sector for a disk it free up all direct,indirect and db_indirect disk sectors
-*/
-void inode_free(block_sector_t inode_sector){
-
-  lock_acquire(&free_map_lock);
-  block_sector_t sector, i_sector, di_sector;
-
-  /*relase empty and release direct pointer*/
-  bufcache_read(inode_sector, &sector,
-    offsetof(struct inode_disk, direct_ptrs),
-     sizeof(block_sector_t));
-
-  if(sector)
-    free_map_release(sector,1);
-  sector = 0;
-  bufcache_write(inode_sector, &sector,
-   offsetof(struct inode_disk, direct_ptrs),
-    sizeof(block_sector_t));
-
-
-  /*release and empty indirect pointer*/
-  bufcache_read(inode_sector, &i_sector, offsetof(struct inode_disk, singly_indirect_ptrs), sizeof(block_sector_t));
-  if(i_sector){
-    for (int i = 0; i < INDIRECT_BLOCKS; ++i){
-      /* code */
-      bufcache_read(i_sector,&sector,i * sizeof(block_sector_t), sizeof(block_sector_t));
-      if (sector){
-        /* code */
-        free_map_release(sector,1);
-      }
-      sector = 0;
-      bufcache_write(i_sector,&sector,i * sizeof(block_sector_t), sizeof(block_sector_t));
+/* Returns the delayed data of file sector L of INODE, or a null
+   pointer if L is not held back.  The caller must hold INODE's
+   map_lock, shared or exclusive. */
+static uint8_t *
+delayed (struct inode *inode, uint32_t l)
+{
+  if (l < inode->delay_start || l - inode->delay_start >= inode->delay_cnt)
+    return NULL;
+  return inode->delay_data + (l - inode->delay_start) * BLOCK_SECTOR_SIZE;
+}
+
+/* Gives back the space reserved for CNT of INODE's delayed
+   sectors, or all that is left once none are held. */
+static void
+delay_unreserve (struct inode *inode, size_t cnt)
+{
+  size_t data = inode->delay_reserved, map = inode->delay_map_reserved;
+
+  if (inode->delay_cnt > 0)
+    {
+      data = cnt < data ? cnt : data;
+      map = cnt < map ? cnt : map;
     }
-    free_map_release(i_sector,1);
-  }
-  i_sector = 0;
-  bufcache_write(inode_sector, &i_sector, offsetof(struct inode_disk, singly_indirect_ptrs), sizeof(block_sector_t));
-
-
-  /*release and empty db_indirect pointers*/
-  bufcache_read(inode_sector, &di_sector, offsetof(struct inode_disk, doubly_indirect_ptrs), sizeof(block_sector_t));
-  if (di_sector){
-    // there are INDIRECT_BLOCKS of single_indirect_sectors inside of doubly_indirect_sectores
-
-    /*loop for level 2*/
-    for (int i = 0; i < INDIRECT_BLOCKS; ++i){
-      /* code */
-      bufcache_read(di_sector, &i_sector, i * sizeof(block_sector_t), sizeof(block_sector_t));
-      // if the indirect_ptr exists then free everything inside it
-      if (i_sector){
-
-
-        /* loop for level 1 */
-        for (int j = 0; i < INDIRECT_BLOCKS; ++i){
-          /* code */
-          bufcache_read(i_sector, &sector, j * sizeof(block_sector_t), sizeof(block_sector_t));
-          // if the entry is not empty then free it.
-          if(sector){
-            free_map_release(sector,1);
-          }
-          sector = 0;
-          bufcache_write(i_sector, &sector, j * sizeof(block_sector_t), sizeof(block_sector_t));
-        } // end of level 1 loop
-        // free the indirect_sector
-        free_map_release(i_sector,1);
-      }
+  free_map_unreserve (data + map);
+  inode->delay_reserved -= data;
+  inode->delay_map_reserved -= map;
+}
 
-    } // end of level 2 loop.
+/* Forgets INODE's delayed sectors from file sector L on, giving
+   back the space reserved for them.  The caller must hold INODE's
+   map_lock exclusively. */
+static void
+delay_drop (struct inode *inode, uint32_t l)
+{
+  size_t keep = 0, drop;
 
-    // free the di_sector
-    free_map_release(di_sector,1);
+  if (l > inode->delay_start)
+    keep = l - inode->delay_start;
+  if (keep >= inode->delay_cnt)
+    return;
+  drop = inode->delay_cnt - keep;
+  inode->delay_cnt = keep;
+  delay_unreserve (inode, drop);
+}
 
-  } // end of if statement of db_indirect_ptrs
-  di_sector = 0;
-  
-  bufcache_write(inode_sector, &di_sector,
-   offsetof(struct inode_disk, doubly_indirect_ptrs),
-    sizeof(block_sector_t));
+/* Writes back INODE's delayed sectors: maps them in as few runs as
+   the disk allows, out of the space reserved for them and for the
+   leaves that map them, and writes each run to disk with one device
+   command.  delay_sector() never holds more sectors than the extent
+   map can surely take, so this fails only if the free map cannot be
+   updated.  The sectors that could not be mapped are then kept, and
+   false is returned.  The caller must hold INODE's map_lock
+   exclusively. */
+static bool
+delay_flush (struct inode *inode)
+{
+  uint32_t start = inode->delay_start;
+  uint32_t end = start + inode->delay_cnt;
+  uint32_t mapped;
+  uint32_t l;
 
-  lock_release(&free_map_lock);
+  if (inode->delay_cnt == 0)
+    return true;
+
+  for (l = start; l < end; )
+    {
+      size_t got = map_run (inode, l, end - l,
+                            end >= bytes_to_sectors (inode->data.length),
+                            (off_t) start * BLOCK_SECTOR_SIZE,
+                            (off_t) end * BLOCK_SECTOR_SIZE);
+      if (got == 0)
+        break;
+      l += got;
+    }
+  xlate_clear (inode);
+  inode_sync (inode);
+
+  mapped = l;
+  for (l = start; l < mapped; )
+    {
+      size_t run;
+      block_sector_t sector = lookup_run (inode, l, &run);
+      if (run > mapped - l)
+        run = mapped - l;
+      bufcache_write_direct (sector, run, delayed (inode, l));
+      l += run;
+    }
+
+  if (mapped < end)
+    memmove (inode->delay_data, delayed (inode, mapped),
+             (end - mapped) * BLOCK_SECTOR_SIZE);
+  inode->delay_start = mapped;
+  inode->delay_cnt = end - mapped;
+  delay_unreserve (inode, mapped - start);
+  return mapped == end;
 }
 
+/* Returns the in-memory copy of file sector L of INODE, a hole
+   that is being written, for the caller to write into.  Sectors
+   are held back in one run of consecutive file sectors, each with
+   a sector reserved for its data and one for a leaf the extent map
+   may need to map it.  The run also reserves one block for each
+   level of index blocks the tree may split or grow.  A sector that does not extend the run, or a
+   full run, writes the run back first, and so does a run as long
+   as the extent map has certain room for.  Returns a null pointer
+   if the sector cannot be held back, because the disk is full, the
+   extent map may be, or memory allocation fails; the caller should
+   then map the sector at once, if it can.  The caller must hold
+   INODE's map_lock exclusively. */
+static uint8_t *
+delay_sector (struct inode *inode, uint32_t l)
+{
+  uint8_t *data = delayed (inode, l);
+  size_t map;
+
+  if (data != NULL)
+    return data;
+  if (inode->delay_cnt > 0
+      && (l != inode->delay_start + inode->delay_cnt
+          || inode->delay_cnt == DELAY_MAX
+          || inode->delay_cnt >= extent_room (&inode->data))
+      && !delay_flush (inode))
+    return NULL;
+  if (extent_room (&inode->data) == 0)
+    return NULL;
+  if (inode->delay_data == NULL)
+    {
+      inode->delay_data = malloc (DELAY_MAX * BLOCK_SECTOR_SIZE);
+      if (inode->delay_data == NULL)
+        return NULL;
+    }
+  map = inode->delay_cnt == 0 ? 1 + DEPTH_MAX : 1;
+  if (!free_map_reserve (1 + map))
+    {
+      /* The disk is nearly full: give back what the run holds in
+         reserve, so that the caller can map the sector at once. */
+      delay_flush (inode);
+      return NULL;
+    }
+  inode->delay_reserved++;
+  inode->delay_map_reserved += map;
+  if (inode->delay_cnt == 0)
+    inode->delay_start = l;
+  data = inode->delay_data + inode->delay_cnt++ * BLOCK_SECTOR_SIZE;
+  memset (data, 0, BLOCK_SECTOR_SIZE);
+  return data;
+}
+
+/*
+  ** given an on-disk inode it frees all of its data sectors and extent leaves
+  ** inline files have none, since their CNT is 0
+*/
+void inode_free(struct inode_disk *disk_inode){
+  struct release_batch batch;
+  batch.cnt = 0;
+  disk_unmap(disk_inode, 0, UINT32_MAX, &batch);
+  batch_flush(&batch);
+}
 
 
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+/* Inodes in memory, indexed by sector.  These are the open inodes
+   plus those in closed_inodes, which have open_cnt 0 and are kept
+   in least-recently-closed order so that reopening them needs no
+   disk access.  Both, and every inode's open_cnt, are guarded by
+   inode_list_lock. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
 struct lock inode_list_lock;
 
+/* Signaled when inode_open() finishes reading in an inode, which it
+   does without holding inode_list_lock. */
+static struct condition inode_loaded;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Returns the in-memory inode for SECTOR, or a null pointer if
+   there is none. */
+static struct inode *
+inode_find (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&inode_list_lock));
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
+
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
   lock_init(&inode_list_lock);
+  cond_init (&inode_loaded);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out as a hole that reads as zeros;
+   sectors are only allocated as they are written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
@@ -331,25 +1188,21 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_leaf) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_node) == BLOCK_SECTOR_SIZE);
 
-  lock_acquire(&free_map_lock);
-  if(!inode_extend(sector,0)){
-    lock_release(&free_map_lock);
-    inode_free(sector);
+  disk_inode = calloc (1, sizeof *disk_inode);
+  if (disk_inode == NULL)
     return false;
-
-  }
-
-  lock_release(&free_map_lock);
-  bufcache_write(sector, &length, offsetof(struct inode_disk, length), sizeof(off_t));
-  unsigned magic_local = INODE_MAGIC;
-  
-  bufcache_write(sector, &magic_local,
-   offsetof(struct inode_disk, magic), sizeof(unsigned) );
-
-  uint32_t is_it = is_dir ? 1 : 0;
-  bufcache_write(sector, &is_it, offsetof(struct inode_disk, isdir), sizeof(unsigned) );
-
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->isdir = is_dir ? 1 : 0;
+
+  /* Small files keep their data in the inode. */
+  if (length <= INLINE_BYTES)
+    disk_inode->is_inline = 1;
+  bufcache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  free (disk_inode);
   return true;
 }
 
@@ -359,21 +1212,28 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
+  /* Check whether this inode is already open or recently closed.
+     One that another thread is reading in may be closed again and
+     freed before this thread runs, so it is looked up anew. */
   lock_acquire(&inode_list_lock);
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  while ((inode = inode_find (sector)) != NULL && inode->loading)
+    cond_wait (&inode_loaded, &inode_list_lock);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          lock_release(&inode_list_lock);
-          return inode;
+          if (inode->kept)
+            inode->kept = false;
+          else
+            {
+              list_remove (&inode->closed_elem);
+              closed_cnt--;
+            }
         }
+      lock_release(&inode_list_lock);
+      return inode;
     }
 
   /* Allocate memory. */
@@ -382,14 +1242,35 @@ inode_open (block_sector_t sector)
     lock_release(&inode_list_lock);
     return NULL;
   }
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  lock_init(&inode->inode_lock);
+  /* Initialize.  The inode goes into open_inodes at once, so that
+     other openers wait for it rather than read it in too, but its
+     sector is read with inode_list_lock released. */
   inode->sector = sector;
+  inode->loading = true;
+  inode->kept = false;
+  hash_insert (&open_inodes, &inode->elem);
+  lock_init(&inode->inode_lock);
+  rw_lock_init(&inode->map_lock);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  inode->extending = false;
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  inode->ra_window = 0;
+  xlate_clear (inode);
+  inode->xlate_next = 0;
+  inode->prealloc_cnt = 0;
+  inode->delay_data = NULL;
+  inode->delay_start = 0;
+  inode->delay_cnt = 0;
+  inode->delay_reserved = 0;
+  inode->delay_map_reserved = 0;
+  lock_release(&inode_list_lock);
+
+  bufcache_read (sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_acquire(&inode_list_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &inode_list_lock);
   lock_release(&inode_list_lock);
   return inode;
 }
@@ -398,10 +1279,12 @@ inode_open (block_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  lock_acquire(&inode->inode_lock);
   if (inode != NULL)
-    inode->open_cnt++;
-  lock_release(&inode->inode_lock);
+    {
+      lock_acquire(&inode_list_lock);
+      inode->open_cnt++;
+      lock_release(&inode_list_lock);
+    }
   return inode;
 }
 
@@ -412,35 +1295,135 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Frees INODE, which must no longer be in open_inodes, and its
+   blocks too if it was removed, dropping the data it held back for
+   them.  An inode that was not removed holds none back by now,
+   since inode_close() writes it back before letting it go. */
+static void
+inode_destroy (struct inode *inode)
+{
+  if (inode->removed)
+    delay_drop (inode, 0);
+  ASSERT (inode->delay_cnt == 0);
+  prealloc_release (inode);
+  free (inode->delay_data);
+  if (inode->removed)
+    {
+      inode_free(&inode->data);
+      inode_sync(inode);
+      free_map_release (inode->sector, 1);
+    }
+  free (inode);
+}
+
+/* Closes INODE and writes it to disk, along with any data written
+   to holes that it still held back.
+   If this was the last reference to INODE, keeps it among the
+   recently closed inodes, making room by freeing the one closed
+   longest ago.  If INODE was also a removed inode, frees it and its
+   blocks at once instead, dropping the data it held back.  If that
+   data cannot be written back, the error is logged and INODE stays
+   in memory, out of closed_inodes, for inode_flush_all() to retry. */
 void
 inode_close (struct inode *inode)
 {
+  struct inode *victim = NULL;
+  bool held = false;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
-  lock_acquire(&inode->inode_lock);
-  inode->open_cnt--;
-  lock_release(&inode->inode_lock);
 
-  /* Release resources if this was the last opener. */
-  if (inode->open_cnt == 0)
+  /* Only the last close writes back held-back data.  With no other
+     reference left, nobody else holds the map_lock, so looking for
+     that data does not wait on I/O under inode_list_lock.  Writing
+     it back releases inode_list_lock, so the inode may be reopened
+     and written meanwhile; the check is then made again. */
+  lock_acquire(&inode_list_lock);
+  while (inode->open_cnt == 1 && !inode->removed)
     {
-      /* Remove from inode list and release lock. */
+      bool flushed;
+
+      rw_lock_acquire_write (&inode->map_lock);
+      held = inode->delay_cnt > 0;
+      if (!held)
+        {
+          free (inode->delay_data);
+          inode->delay_data = NULL;
+        }
+      rw_lock_release_write (&inode->map_lock);
+      if (!held)
+        break;
+
+      lock_release(&inode_list_lock);
+      rw_lock_acquire_write (&inode->map_lock);
+      flushed = delay_flush (inode);
+      rw_lock_release_write (&inode->map_lock);
       lock_acquire(&inode_list_lock);
-      list_remove (&inode->elem);
+      if (!flushed)
+        break;
+    }
+
+  if (--inode->open_cnt > 0)
+    {
       lock_release(&inode_list_lock);
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
+      return;
+    }
+  if (inode->removed)
+    {
+      hash_delete (&open_inodes, &inode->elem);
+      victim = inode;
+    }
+  else if (held)
+    {
+      printf ("inode %"PRDSNu": cannot write back delayed data, "
+              "keeping it\n", inode->sector);
+      inode->kept = true;
+    }
+  else
+    {
+      prealloc_release (inode);
+      list_push_front (&closed_inodes, &inode->closed_elem);
+      if (++closed_cnt > CLOSED_MAX)
         {
-          inode_free(inode->sector);
-          free_map_release (inode->sector, 1);
+          victim = list_entry (list_pop_back (&closed_inodes),
+                               struct inode, closed_elem);
+          hash_delete (&open_inodes, &victim->elem);
+          closed_cnt--;
         }
+    }
+  lock_release(&inode_list_lock);
+
+  if (victim != NULL)
+    inode_destroy (victim);
+}
+
+/* Writes back the data every inode in memory holds back, so that
+   it reaches the disk before the file system shuts down.  Logs
+   each inode whose data cannot be written back and returns false
+   if there was any. */
+bool
+inode_flush_all (void)
+{
+  struct hash_iterator i;
+  bool success = true;
 
-      free (inode);
+  lock_acquire (&inode_list_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+      rw_lock_acquire_write (&inode->map_lock);
+      if (!delay_flush (inode))
+        {
+          printf ("inode %"PRDSNu": cannot write back delayed data\n",
+                  inode->sector);
+          success = false;
+        }
+      rw_lock_release_write (&inode->map_lock);
     }
+  lock_release (&inode_list_lock);
+  return success;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -454,32 +1437,113 @@ inode_remove (struct inode *inode)
   lock_release(&inode->inode_lock);
 }
 
+/* Queues read-ahead after a read of INODE that covered [OFFSET,
+   END).  A read that continues where the previous one stopped is
+   sequential: the first one opens a small window, and the window
+   doubles each time the reader has used up half of what was read
+   ahead.  Any other read closes the window.  Only sectors past
+   what has already been requested are queued, so a stream of
+   small reads does not queue the same sectors over and over.
+   The caller must hold INODE's map_lock shared. */
+static void
+read_ahead (struct inode *inode, off_t offset, off_t end)
+{
+  off_t pos, limit;
+
+  lock_acquire (&inode->inode_lock);
+  if (offset == inode->ra_next && end > offset)
+    {
+      if (inode->ra_window == 0)
+        inode->ra_window = RA_MIN_WINDOW;
+      else if (inode->ra_window < RA_MAX_WINDOW
+               && inode->ra_end - end
+                  < inode->ra_window * BLOCK_SECTOR_SIZE / 2)
+        inode->ra_window *= 2;
+    }
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_end = 0;
+    }
+  inode->ra_next = end;
+  if (inode->ra_window == 0)
+    {
+      lock_release (&inode->inode_lock);
+      return;
+    }
+
+  pos = ROUND_UP (end > inode->ra_end ? end : inode->ra_end,
+                  BLOCK_SECTOR_SIZE);
+  limit = ROUND_UP (end, BLOCK_SECTOR_SIZE)
+          + inode->ra_window * BLOCK_SECTOR_SIZE;
+  if (limit > inode->data.length)
+    limit = inode->data.length;
+  if (limit > pos)
+    inode->ra_end = ROUND_UP (limit, BLOCK_SECTOR_SIZE);
+  lock_release (&inode->inode_lock);
+
+  for (; pos < limit; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        bufcache_prefetch (sector);
+    }
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Readers share INODE's map_lock, so they run in parallel with
+   each other and with writes that do not change the length.
+   Reading never allocates: a hole in the file reads as zeros, or
+   as the data written to it if that has not been written back.
+   Long runs of whole sectors are read straight from the disk,
+   one device command per extent, and do not start read-ahead. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  lock_acquire(&inode->inode_lock);
-  block_sector_t sector_idx;
+  bool direct = false;
+
+  rw_lock_acquire_read(&inode->map_lock);
+  if (inode->data.is_inline)
+    {
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      rw_lock_release_read(&inode->map_lock);
+      return bytes_read;
+    }
   while (size > 0)
     {
-      off_t inode_left = inode_length (inode) - offset;
-      /* Disk sector to read, starting byte offset within sector. */
-      //block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if(inode_left > 0){
-        sector_idx = inode_extend(inode->sector, offset);
-      } else{
-        lock_release(&inode->inode_lock);
-        return bytes_read;
-        //sector_idx = 0;//byte_to_sector (inode, offset);
-      }
+      off_t inode_left = inode->data.length - offset;
+      if (inode_left <= 0)
+        break;
+
+      size_t cnt;
+      block_sector_t run = direct_run (inode, offset,
+                                       size < inode_left ? size : inode_left,
+                                       &cnt);
+      if (run != 0)
+        {
+          bufcache_read_direct (run, cnt, buffer + bytes_read);
+          size -= cnt * BLOCK_SECTOR_SIZE;
+          offset += cnt * BLOCK_SECTOR_SIZE;
+          bytes_read += cnt * BLOCK_SECTOR_SIZE;
+          direct = true;
+          continue;
+        }
 
+      /* Disk sector to read, starting byte offset within sector. */
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
 
+      /* Bytes left in inode, bytes left in sector, lesser of the two. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -487,7 +1551,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
-      bufcache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      uint8_t *data;
+      if (sector_idx != 0)
+        bufcache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+      else if ((data = delayed (inode, offset / BLOCK_SECTOR_SIZE)) != NULL)
+        memcpy (buffer + bytes_read, data + sector_ofs, chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
@@ -495,45 +1565,112 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       bytes_read += chunk_size;
     }
 
-  lock_release(&inode->inode_lock);
+  if (!direct)
+    read_ahead (inode, offset - bytes_read, offset);
+  rw_lock_release_read(&inode->map_lock);
   return bytes_read;
 }
 
+/* Returns true if writes to INODE are denied. */
+static bool
+writes_denied (struct inode *inode)
+{
+  bool denied;
+
+  lock_acquire(&inode->inode_lock);
+  denied = inode->deny_write_cnt > 0;
+  lock_release(&inode->inode_lock);
+  return denied;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   Writes within already allocated sectors share INODE's map_lock;
+   a write that grows the file or fills a hole takes it
+   exclusively.  Data written to holes is held in memory, with its
+   disk space reserved, until it is written back in runs: when the
+   writer moves elsewhere, DELAY_MAX sectors are held, or INODE is
+   closed. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  lock_acquire(&inode->inode_lock);
+  bool exclusive;
 
-  if (inode->deny_write_cnt) {
-    lock_release(&inode->inode_lock);
+  if (writes_denied (inode))
     return 0;
-  }
-  if(size + offset > inode_length(inode)){
-    off_t new_lenght = size+offset;
-    bufcache_write(inode->sector,&new_lenght, offsetof(struct inode_disk, length), sizeof(off_t));
+
+  /* The length and inline data are part of the inode copy, which
+     only changes under the exclusive lock, so a write that grows
+     the file or writes inline data takes it.  The length is checked
+     again once the lock is held, because a truncate may have shrunk
+     the file in between. */
+  exclusive = size + offset > inode_length (inode);
+  if (exclusive)
+    rw_lock_acquire_write(&inode->map_lock);
+  else
+    rw_lock_acquire_read(&inode->map_lock);
+  if (!exclusive
+      && (inode->data.is_inline || size + offset > inode->data.length))
+    {
+      rw_lock_release_read (&inode->map_lock);
+      rw_lock_acquire_write (&inode->map_lock);
+      exclusive = true;
+    }
+  if (inode->data.is_inline)
+    {
+      if (size + offset <= INLINE_BYTES)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (size + offset > inode->data.length)
+            inode->data.length = size + offset;
+          inode_sync (inode);
+          bytes_written = size;
+          goto done;
+        }
+      if (!uninline (inode))
+        goto done;
+    }
+  if(size + offset > inode->data.length){
+    inode->data.length = size + offset;
+    inode_sync(inode);
   }
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
+      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx == 0 && !exclusive)
+        {
+          rw_lock_release_read (&inode->map_lock);
+          rw_lock_acquire_write (&inode->map_lock);
+          exclusive = true;
+
+          /* The file may have been truncated while unlocked. */
+          if (size + offset > inode->data.length)
+            {
+              inode->data.length = size + offset;
+              inode_sync (inode);
+            }
+          continue;
+        }
 
-      block_sector_t sector_idx = inode_extend(inode->sector,offset);
-      if (sector_idx == 0)
-      {
-        lock_release(&inode->inode_lock);
-        return bytes_written;
-      }
+      size_t cnt;
+      block_sector_t run = direct_run (inode, offset, size, &cnt);
+      if (run != 0)
+        {
+          bufcache_write_direct (run, cnt, buffer + bytes_written);
+          size -= cnt * BLOCK_SECTOR_SIZE;
+          offset += cnt * BLOCK_SECTOR_SIZE;
+          bytes_written += cnt * BLOCK_SECTOR_SIZE;
+          continue;
+        }
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -542,7 +1679,23 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      bufcache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+      if (sector_idx != 0)
+        bufcache_write(sector_idx, buffer + bytes_written, sector_ofs,
+                       chunk_size);
+      else
+        {
+          /* Choose where a hole goes on disk only when it is written
+             back, together with the sectors written after it.  If
+             it cannot be held back, map it now, or stop short. */
+          uint8_t *data = delay_sector (inode, offset / BLOCK_SECTOR_SIZE);
+          if (data != NULL)
+            memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+          else if (fill_holes (inode, offset, offset + chunk_size))
+            bufcache_write (byte_to_sector (inode, offset),
+                            buffer + bytes_written, sector_ofs, chunk_size);
+          else
+            break;
+        }
 
       /* Advance. */
       size -= chunk_size;
@@ -550,19 +1703,186 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
 
-  lock_release(&inode->inode_lock);
+ done:
+  if (exclusive)
+    rw_lock_release_write(&inode->map_lock);
+  else
+    rw_lock_release_read(&inode->map_lock);
   return bytes_written;
 }
 
+/* Allocates every sector of INODE in [OFFSET, OFFSET + LENGTH),
+   growing INODE to OFFSET + LENGTH bytes if it is shorter, so that
+   later writes to the range need no allocation.  An empty range
+   does nothing.  Returns false if writes to INODE are denied or
+   the disk fills up, in which case part of the range may have
+   been allocated. */
+bool
+inode_allocate (struct inode *inode, off_t offset, off_t length)
+{
+  bool success;
+
+  ASSERT (offset >= 0 && length >= 0);
+  if (length == 0)
+    return true;
+  if (writes_denied (inode))
+    return false;
+
+  rw_lock_acquire_write (&inode->map_lock);
+  if (inode->data.is_inline && offset + length <= INLINE_BYTES)
+    success = true;
+  else
+    success = ((!inode->data.is_inline || uninline (inode))
+               && delay_flush (inode)
+               && fill_holes (inode, offset, offset + length));
+  if (success && offset + length > inode->data.length)
+    {
+      inode->data.length = offset + length;
+      inode_sync (inode);
+    }
+  rw_lock_release_write (&inode->map_lock);
+  return success;
+}
+
+/* Zeroes bytes [POS, END) of INODE, which lie within one sector,
+   unless that sector is a hole already. */
+static void
+zero_bytes (struct inode *inode, off_t pos, off_t end)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  block_sector_t sector;
+  uint8_t *data;
+
+  if (pos >= end)
+    return;
+  sector = byte_to_sector (inode, pos);
+  if (sector != 0)
+    bufcache_write (sector, zeros, pos % BLOCK_SECTOR_SIZE, end - pos);
+  else if ((data = delayed (inode, pos / BLOCK_SECTOR_SIZE)) != NULL)
+    memset (data + pos % BLOCK_SECTOR_SIZE, 0, end - pos);
+}
+
+/* Unmaps file sectors [A, B) of INODE and gives their disk sectors
+   back to the free map.  Returns false, with nothing unmapped, if
+   the map could not be split around the hole; see disk_unmap().  The caller must hold
+   INODE's map_lock exclusively. */
+static bool
+unmap_sectors (struct inode *inode, uint32_t a, uint32_t b)
+{
+  struct release_batch batch;
+  bool success;
+
+  if (a >= b)
+    return true;
+  batch.cnt = 0;
+  success = disk_unmap (&inode->data, a, b, &batch);
+  batch_flush (&batch);
+  xlate_clear (inode);
+  inode_sync (inode);
+  return success;
+}
+
+/* Sets INODE's length to LENGTH bytes.  Shrinking frees the sectors
+   past the new end; growing leaves a hole that reads as zeros.
+   Returns false if writes to INODE are denied or the disk is
+   full. */
+bool
+inode_truncate (struct inode *inode, off_t length)
+{
+  bool success = true;
+
+  ASSERT (length >= 0);
+  if (writes_denied (inode))
+    return false;
+
+  rw_lock_acquire_write (&inode->map_lock);
+  prealloc_release (inode);
+  if (inode->data.is_inline)
+    {
+      if (length > INLINE_BYTES)
+        success = uninline (inode);
+      else if (length < inode->data.length)
+        memset (inode->data.inline_data + length, 0,
+                inode->data.length - length);
+    }
+  else if (length < inode->data.length)
+    {
+      /* Bytes past the end in the last sector kept must read as
+         zeros if the file grows again. */
+      uint32_t keep = DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE);
+      delay_drop (inode, keep);
+      zero_bytes (inode, length, (off_t) keep * BLOCK_SECTOR_SIZE);
+      success = unmap_sectors (inode, keep, UINT32_MAX);
+    }
+  if (success)
+    {
+      inode->data.length = length;
+      inode_sync (inode);
+    }
+  rw_lock_release_write (&inode->map_lock);
+  return success;
+}
+
+/* Makes bytes [OFFSET, OFFSET + LENGTH) of INODE read as zeros
+   without changing its length, freeing the sectors that lie wholly
+   within the range.  Returns false if writes to INODE are denied or
+   the disk was too full to split the extent map around the hole. */
+bool
+inode_punch_hole (struct inode *inode, off_t offset, off_t length)
+{
+  off_t end = offset + length;
+  bool success = true;
+
+  ASSERT (offset >= 0 && length >= 0);
+  if (writes_denied (inode))
+    return false;
+
+  rw_lock_acquire_write (&inode->map_lock);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  if (offset >= end)
+    ;
+  else if (inode->data.is_inline)
+    {
+      memset (inode->data.inline_data + offset, 0, end - offset);
+      inode_sync (inode);
+    }
+  else
+    {
+      uint32_t a = DIV_ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+      uint32_t b = end / BLOCK_SECTOR_SIZE;
+      off_t head_end = (off_t) a * BLOCK_SECTOR_SIZE;
+
+      /* Zero what is left of the sectors at either end, once the
+         whole sectors are unmapped, so that a failure leaves the
+         file as it was.  Held-back sectors cannot be unmapped, so
+         write them back first. */
+      if (head_end > end)
+        head_end = end;
+      success = delay_flush (inode) && unmap_sectors (inode, a, b);
+      if (success)
+        {
+          zero_bytes (inode, offset, head_end);
+          zero_bytes (inode, (off_t) b * BLOCK_SECTOR_SIZE > head_end
+                             ? (off_t) b * BLOCK_SECTOR_SIZE : head_end, end);
+        }
+    }
+  rw_lock_release_write (&inode->map_lock);
+  return success;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode)
 {
+  /* OPEN_CNT is guarded by inode_list_lock, which comes first. */
+  lock_acquire(&inode_list_lock);
   lock_acquire(&inode->inode_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   lock_release(&inode->inode_lock);
+  lock_release(&inode_list_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -571,20 +1891,22 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
+  lock_acquire(&inode_list_lock);
   lock_acquire(&inode->inode_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
   lock_release(&inode->inode_lock);
+  lock_release(&inode_list_lock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.  The length only
+   changes under the exclusive map_lock, and reading it is a single
+   aligned load, so no lock is taken. */
 off_t
 inode_length (const struct inode *inode)
 {
-  off_t length;
-  bufcache_read(inode->sector,&length, offsetof(struct inode_disk, length), sizeof(off_t));
-  return length;
+  return inode->data.length;
 }
 
 uint32_t is_it_dir(block_sector_t sector){
@@ -595,17 +1917,10 @@ uint32_t is_it_dir(block_sector_t sector){
 
 bool is_inode_open(block_sector_t sector){
   struct inode *inode;
-  struct list_elem *e;
+  bool open;
   lock_acquire(&inode_list_lock);
-  for (e = list_begin(&open_inodes); e != list_end(&open_inodes); e = list_next(e))
-  {
-    /* code */
-    inode = list_entry(e,struct inode, elem);
-    if(inode->sector == sector && inode->open_cnt > 1){
-      lock_release(&inode_list_lock);
-      return true;
-    }
-  }
+  inode = inode_find(sector);
+  open = inode != NULL && inode->open_cnt > 1;
   lock_release(&inode_list_lock);
-  return false;
+  return open;
 }
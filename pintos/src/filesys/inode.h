@@ -16,9 +16,13 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t offset, off_t length);
+bool inode_truncate (struct inode *, off_t length);
+bool inode_punch_hole (struct inode *, off_t offset, off_t length);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_flush_all (void);
 uint32_t is_it_dir(block_sector_t sector);
 bool is_inode_open(block_sector_t sector);
 
@@ -0,0 +1,26 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+#include <stdint.h>
+
+/* Buffer cache counters since boot, as returned by the cache_stats()
+   system call. */
+struct cache_stats
+  {
+    unsigned hits;              /* Accesses served from the cache. */
+    unsigned misses;            /* Accesses that had to load an entry. */
+    unsigned evictions;         /* Entries given over to another unit. */
+    unsigned write_backs;       /* Dirty entries written to disk. */
+    unsigned blind_writes;      /* Misses by writes that skipped the read. */
+    unsigned ready_waits;       /* Waits for an entry to finish loading. */
+    unsigned victim_waits;      /* Waits for any entry to become free. */
+    unsigned lock_waits;        /* Times the cache lock was already held. */
+    unsigned readahead_used;    /* Read-ahead entries that were then used. */
+    unsigned readahead_wasted;  /* Read-ahead entries evicted unused. */
+    unsigned capacity;          /* Sectors the cache holds right now. */
+    uint64_t bytes_read;        /* Bytes read from the disk. */
+    uint64_t bytes_written;     /* Bytes written to the disk, counted by
+                                   sector, direct transfers included. */
+  };
+
+#endif /* lib/cache-stats.h */
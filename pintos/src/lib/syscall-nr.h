@@ -31,7 +31,11 @@ enum
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
     SYS_INUMBER,                 /* Returns the inode number for a fd. */
     SYS_HIT_RATE,
-    SYS_DEVICE_WRITES
+    SYS_DEVICE_WRITES,
+    SYS_CACHE_STATS,            /* Reads buffer cache counters. */
+    SYS_FALLOCATE,              /* Preallocates space for a file. */
+    SYS_FTRUNCATE,              /* Changes the size of a file. */
+    SYS_PUNCH_HOLE              /* Frees a range of a file. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -197,3 +197,27 @@ int num_device_writes(void)
 {
   return syscall0(SYS_DEVICE_WRITES);
 }
+
+void
+cache_stats (struct cache_stats *stats)
+{
+  syscall1 (SYS_CACHE_STATS, stats);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+bool
+ftruncate (int fd, unsigned length)
+{
+  return syscall2 (SYS_FTRUNCATE, fd, length);
+}
+
+bool
+punch_hole (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_PUNCH_HOLE, fd, offset, length);
+}
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <cache-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -47,5 +48,9 @@ bool isdir (int fd);
 int inumber (int fd);
 int hit_rate(void);
 int num_device_writes(void);
+void cache_stats (struct cache_stats *);
+bool fallocate (int fd, unsigned offset, unsigned length);
+bool ftruncate (int fd, unsigned length);
+bool punch_hole (int fd, unsigned offset, unsigned length);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,124 @@
+/* Checks that streaming through a file larger than the buffer
+   cache does not push out a small set of frequently used files.
+   Run with the 2Q replacement policy; plain LRU fails it. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Small files are still too big to keep their data inline in
+   their inodes, so reading them goes through the cache. */
+#define SMALL_FILES 12
+#define SMALL_SIZE 500
+#define MID_SECTORS 64
+#define BIG_SECTORS 128
+#define SECTOR_SIZE 512
+
+static int small_fds[SMALL_FILES];
+static char buf[SECTOR_SIZE];
+
+/* Reads every small file from the start. */
+static void
+read_small_files (void)
+{
+  int i;
+
+  for (i = 0; i < SMALL_FILES; i++)
+    {
+      seek (small_fds[i], 0);
+      if (read (small_fds[i], buf, SMALL_SIZE) != SMALL_SIZE)
+        fail ("read small file %d", i);
+    }
+}
+
+/* Closes FD, open on file NAME, and returns a new file descriptor
+   for NAME.  Closing writes back data that was written to holes,
+   which is held outside the cache until then. */
+static int
+reopen (int fd, const char *name)
+{
+  close (fd);
+  fd = open (name);
+  if (fd < 2)
+    fail ("reopen \"%s\"", name);
+  return fd;
+}
+
+/* Creates file NAME, SECTORS sectors long, and returns an open
+   file descriptor for it. */
+static int
+make_file (const char *name, int sectors)
+{
+  int fd, i;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  for (i = 0; i < sectors; i++)
+    if (write (fd, buf, SECTOR_SIZE) != SECTOR_SIZE)
+      fail ("write \"%s\" sector %d", name, i);
+  msg ("write \"%s\"", name);
+  return reopen (fd, name);
+}
+
+/* Reads the first SECTORS sectors of FD from the start. */
+static void
+read_sectors (int fd, int sectors)
+{
+  int i;
+
+  seek (fd, 0);
+  for (i = 0; i < sectors; i++)
+    if (read (fd, buf, SECTOR_SIZE) != SECTOR_SIZE)
+      fail ("read sector %d", i);
+}
+
+void
+test_main (void)
+{
+  char name[16];
+  int mid_fd, big_fd;
+  int i, rate;
+
+  for (i = 0; i < SMALL_FILES; i++)
+    {
+      snprintf (name, sizeof name, "small%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+      small_fds[i] = open (name);
+      if (small_fds[i] < 2)
+        fail ("open \"%s\"", name);
+      if (write (small_fds[i], buf, SMALL_SIZE) != SMALL_SIZE)
+        fail ("write \"%s\"", name);
+      small_fds[i] = reopen (small_fds[i], name);
+    }
+  msg ("create small files");
+
+  mid_fd = make_file ("mid", MID_SECTORS);
+  big_fd = make_file ("big", BIG_SECTORS);
+
+  /* Touch the small files twice, far enough apart that the first
+     accesses have left the cache, so they count as hot. */
+  read_small_files ();
+  read_sectors (mid_fd, MID_SECTORS);
+  read_small_files ();
+  msg ("warm small files");
+
+  read_sectors (big_fd, BIG_SECTORS);
+  read_sectors (big_fd, BIG_SECTORS);
+  msg ("stream \"big\" twice");
+
+  hit_rate ();
+  read_small_files ();
+  rate = hit_rate ();
+  msg ("small files hit rate %d%% after scan", rate);
+  if (rate < 90)
+    fail ("small files hit rate %d%% after scan, expected at least 90%%",
+          rate);
+  msg ("small files stayed cached");
+
+  for (i = 0; i < SMALL_FILES; i++)
+    close (small_fds[i]);
+  close (mid_fd);
+  close (big_fd);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The measured hit rate varies from run to run; the test itself
+# fails if it drops below 90%, so only its presence is checked here.
+s/(small files hit rate )\d+(% after scan)$/$1N$2/ foreach @output;
+compare_output ("run", \@output, [<<'EOF']);
+(cache-scan) begin
+(cache-scan) create small files
+(cache-scan) create "mid"
+(cache-scan) open "mid"
+(cache-scan) write "mid"
+(cache-scan) create "big"
+(cache-scan) open "big"
+(cache-scan) write "big"
+(cache-scan) warm small files
+(cache-scan) stream "big" twice
+(cache-scan) small files hit rate N% after scan
+(cache-scan) small files stayed cached
+(cache-scan) end
+cache-scan: exit(0)
+EOF
+pass;
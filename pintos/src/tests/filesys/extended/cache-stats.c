@@ -0,0 +1,63 @@
+/* Checks that cache_stats() reports hits, misses and device
+   traffic, and that reading the counters does not reset them. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SECTORS 16
+#define SECTOR_SIZE 512
+
+static char buf[SECTOR_SIZE];
+
+/* Reads all of FD from the start. */
+static void
+read_all (int fd)
+{
+  int i;
+
+  seek (fd, 0);
+  for (i = 0; i < SECTORS; i++)
+    if (read (fd, buf, SECTOR_SIZE) != SECTOR_SIZE)
+      fail ("read sector %d", i);
+}
+
+void
+test_main (void)
+{
+  struct cache_stats before, after, again;
+  int fd, i;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  for (i = 0; i < SECTORS; i++)
+    if (write (fd, buf, SECTOR_SIZE) != SECTOR_SIZE)
+      fail ("write sector %d", i);
+  msg ("write \"data\"");
+
+  /* Closing writes back data that was written to holes, which is
+     held outside the cache until then. */
+  close (fd);
+  CHECK ((fd = open ("data")) > 1, "reopen \"data\"");
+
+  cache_stats (&before);
+  read_all (fd);
+  read_all (fd);
+  cache_stats (&after);
+  if (after.hits < before.hits + SECTORS)
+    fail ("%u hits before reads, %u after, expected at least %d more",
+          before.hits, after.hits, SECTORS);
+  if (after.capacity == 0)
+    fail ("cache capacity is 0");
+  if (after.bytes_read < before.bytes_read)
+    fail ("bytes read went down from %llu to %llu",
+          before.bytes_read, after.bytes_read);
+  msg ("reads counted");
+
+  cache_stats (&again);
+  if (again.hits < after.hits || again.misses < after.misses)
+    fail ("reading the statistics reset them");
+  msg ("statistics kept");
+
+  close (fd);
+}
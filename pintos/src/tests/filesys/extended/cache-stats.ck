@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(cache-stats) begin
+(cache-stats) create "data"
+(cache-stats) open "data"
+(cache-stats) write "data"
+(cache-stats) reopen "data"
+(cache-stats) reads counted
+(cache-stats) statistics kept
+(cache-stats) end
+cache-stats: exit(0)
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Preallocates space for an empty file with fallocate(), checks
+   that the file grew and reads as zeros, then writes into the
+   preallocated range and reads the data back. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 20000
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  int fd, i;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (fallocate (fd, 0, FILE_SIZE), "fallocate \"data\"");
+  if (filesize (fd) != FILE_SIZE)
+    fail ("filesize is %d after fallocate, expected %d",
+          filesize (fd), FILE_SIZE);
+
+  memset (buf, 0xcc, sizeof buf);
+  if (read (fd, buf, FILE_SIZE) != FILE_SIZE)
+    fail ("read \"data\"");
+  for (i = 0; i < FILE_SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %d is %d, expected 0", i, buf[i]);
+  msg ("preallocated range reads as zeros");
+
+  CHECK (fallocate (fd, 100, 200), "fallocate inside \"data\"");
+  if (filesize (fd) != FILE_SIZE)
+    fail ("fallocate inside the file changed its size to %d",
+          filesize (fd));
+
+  memset (buf, 'a', sizeof buf);
+  seek (fd, 0);
+  if (write (fd, buf, FILE_SIZE) != FILE_SIZE)
+    fail ("write \"data\"");
+  check_file_handle (fd, "data", buf, FILE_SIZE);
+  close (fd);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-fallocate) begin
+(grow-fallocate) create "data"
+(grow-fallocate) open "data"
+(grow-fallocate) fallocate "data"
+(grow-fallocate) preallocated range reads as zeros
+(grow-fallocate) fallocate inside "data"
+(grow-fallocate) verified contents of "data"
+(grow-fallocate) end
+EOF
+pass;
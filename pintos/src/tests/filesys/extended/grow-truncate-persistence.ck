@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"data" => ["a" x 1000 . "\0" x 1500 . "a" x 500
+                           . "\0" x 3000]});
+pass;
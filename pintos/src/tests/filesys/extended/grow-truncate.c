@@ -0,0 +1,38 @@
+/* Shrinks a file with ftruncate(), grows it again, and punches a
+   hole in it with punch_hole(), checking that the size follows and
+   that the dropped ranges read back as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[10000];
+static char expected[6000];
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  memset (buf, 'a', sizeof buf);
+  if (write (fd, buf, sizeof buf) != sizeof buf)
+    fail ("write \"data\"");
+
+  CHECK (ftruncate (fd, 3000), "truncate \"data\" to 3000 bytes");
+  if (filesize (fd) != 3000)
+    fail ("filesize is %d after shrinking, expected 3000", filesize (fd));
+  CHECK (ftruncate (fd, 6000), "truncate \"data\" to 6000 bytes");
+  if (filesize (fd) != 6000)
+    fail ("filesize is %d after growing, expected 6000", filesize (fd));
+  CHECK (punch_hole (fd, 1000, 1500), "punch hole in \"data\"");
+  if (filesize (fd) != 6000)
+    fail ("punch_hole changed the size to %d", filesize (fd));
+
+  memset (expected, 'a', 3000);
+  memset (expected + 1000, 0, 1500);
+  check_file_handle (fd, "data", expected, sizeof expected);
+  close (fd);
+}
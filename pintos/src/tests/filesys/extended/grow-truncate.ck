@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-truncate) begin
+(grow-truncate) create "data"
+(grow-truncate) open "data"
+(grow-truncate) truncate "data" to 3000 bytes
+(grow-truncate) truncate "data" to 6000 bytes
+(grow-truncate) punch hole in "data"
+(grow-truncate) verified contents of "data"
+(grow-truncate) end
+EOF
+pass;
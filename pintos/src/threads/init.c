@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -247,6 +248,23 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          if (!bufcache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-cache-flush"))
+        bufcache_flush_ticks = atoi (value);
+      else if (!strcmp (name, "-cache-hiwat"))
+        bufcache_high_water = atoi (value);
+      else if (!strcmp (name, "-cache-size"))
+        bufcache_size = atoi (value);
+      else if (!strcmp (name, "-cache-max"))
+        bufcache_max_size = atoi (value);
+      else if (!strcmp (name, "-cache-unit"))
+        bufcache_unit = atoi (value);
+      else if (!strcmp (name, "-cache-quota"))
+        bufcache_quota = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -315,6 +333,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"cache-bench", 1, fsutil_cache_bench},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +380,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  cache-bench        Time buffer cache hits by working set size.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -373,6 +393,13 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=POLICY      Use lru (default) or 2q cache replacement.\n"
+          "  -cache-flush=TICKS Write dirty cache blocks back every TICKS (0: never).\n"
+          "  -cache-hiwat=PCT   Write back early once PCT%% of cache is dirty.\n"
+          "  -cache-size=SECS   Keep SECS sectors of cache (default: 64).\n"
+          "  -cache-max=SECS    Grow cache up to SECS sectors from idle user memory.\n"
+          "  -cache-unit=SECS   Cache and transfer SECS sectors at a time (default 1).\n"
+          "  -cache-quota=PCT   Limit each thread to about PCT%% of the cache.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
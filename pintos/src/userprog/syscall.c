@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -561,6 +562,59 @@ void syscall_helper(struct intr_frame *f) {
       f->eax = get_device_writes();
       break;
     }
+    case SYS_CACHE_STATS:
+    {
+      validate_args(f->esp,1);
+      struct cache_stats stats;
+      for(size_t i = 0; i < sizeof stats; i++)
+        validate_address((void *) args[1] + i);
+      bufcache_get_stats(&stats);
+      memcpy((void *) args[1], &stats, sizeof stats);
+      break;
+    }
+    case SYS_FALLOCATE:
+      /* Preallocate space for a file. */
+    {
+      validate_args(f->esp,3);
+      struct thread *t = thread_current();
+      off_t offset = (off_t) args[2];
+      off_t length = (off_t) args[3];
+      f->eax = false;
+      struct file_struct *cur_file = file_found((int) args[1], t);
+      if(cur_file != NULL && !cur_file->isdir
+         && offset >= 0 && length >= 0 && offset <= INT32_MAX - length) {
+        f->eax = file_allocate((struct file *) cur_file->file_dir, offset, length);
+      }
+      break;
+    }
+    case SYS_FTRUNCATE:
+      /* Change the size of a file. */
+    {
+      validate_args(f->esp,2);
+      struct thread *t = thread_current();
+      off_t length = (off_t) args[2];
+      f->eax = false;
+      struct file_struct *cur_file = file_found((int) args[1], t);
+      if(cur_file != NULL && !cur_file->isdir && length >= 0) {
+        f->eax = file_truncate((struct file *) cur_file->file_dir, length);
+      }
+      break;
+    }
+    case SYS_PUNCH_HOLE:
+      /* Free a range of a file. */
+    {
+      validate_args(f->esp,3);
+      struct thread *t = thread_current();
+      off_t offset = (off_t) args[2];
+      off_t length = (off_t) args[3];
+      f->eax = false;
+      struct file_struct *cur_file = file_found((int) args[1], t);
+      if(cur_file != NULL && !cur_file->isdir
+         && offset >= 0 && length >= 0 && offset <= INT32_MAX - length) {
+        f->eax = file_punch_hole((struct file *) cur_file->file_dir, offset, length);
+      }
+      break;
+    }
     default:
     {
       sys_helper_exit(-1);